@@ -0,0 +1,24 @@
+#pragma once
+#include "utils\utils.h"
+
+namespace Core {
+	// Random distortions of training images, each in one pass: a shift of up to AUGMENT_MAX_SHIFT pixels, a rotation of up to
+	// AUGMENT_MAX_ROTATION degrees about the centre, and an elastic warp whose displacements, of up to AUGMENT_ELASTIC_PIXELS,
+	// are drawn on a coarse AUGMENT_ELASTIC_GRID square grid and interpolated between, so they vary smoothly over the image.
+	// Every output pixel is sampled bilinearly from where the distortion takes it; outside the image is blank.
+	class Augmenter {
+	private:
+		uint m_rows, m_columns;
+		std::mt19937 m_rng;
+
+		std::vector<float> m_elasticX, m_elasticY;		// Per grid node, (AUGMENT_ELASTIC_GRID + 1) squared.
+		std::vector<float> m_sourceX, m_sourceY;		// Per pixel of a row: where it is sampled from.
+		std::vector<float> m_gridWeights;				// Per column: how far along its grid cell it is.
+		std::vector<uint> m_gridCells;					// Per column: its grid cell.
+	public:
+		Augmenter(uint rows, uint columns, std::seed_seq& seed);
+
+		// Writes a distorted copy of source, rows * columns bytes, to target. Returns the non-zero pixels written.
+		uint apply(const unsigned char* source, unsigned char* target);
+	};
+}
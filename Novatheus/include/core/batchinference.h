@@ -0,0 +1,51 @@
+#pragma once
+#include "utils\utils.h"
+#include "core/idxfile.h"
+
+namespace Core {
+	class Genome;
+	class Network;
+
+	// Scores trained genomes on every image of an IDX file, for 'infer'. Images are read straight out of the mapped file and
+	// fed through Network::runInputsBatch a minibatch at a time. Genomes are scored concurrently, one per worker, with the
+	// cores shared out between the workers, so a handful of genomes each get several threads and a whole run's worth get one
+	// each. Each genome's predictions go to a file of its own in 'Novatheus/predictions/'; given labels, each genome's
+	// accuracy is reported, and the genomes ranked by it.
+	class BatchInference : public Utils::HasForwarder {
+	public:
+		enum class Format {
+			Csv,	// 'sample,prediction[,label],output0,output1,...', one line per image.
+			Idx		// An IDX label file of the predictions, readable wherever the dataset's own labels are.
+		};
+	private:
+		struct Entry {
+			uint m_populationID;
+			uint m_generation;
+			std::unique_ptr<Genome> mp_genome;
+			std::unique_ptr<Network> mp_network;
+
+			std::vector<unsigned char> m_predictions;	// Per image.
+			std::vector<float> m_outputs;				// Per image, per output. Only kept for Format::Csv.
+			uint m_correct = 0u;
+			double m_seconds = 0.0;
+		};
+
+		const IdxFile& r_images;
+		const IdxFile* p_labels;
+		std::vector<std::unique_ptr<Entry>> m_entries;
+
+		void score(Entry& entry, Format format);
+		bool write(const Entry& entry, Format format) const;
+	public:
+		// Both files must stay open while this exists. Labels may be null.
+		BatchInference(Utils::Forwarder* forwarder, const IdxFile& images, const IdxFile* labels);
+		~BatchInference();
+
+		// Loads 'Novatheus/genomes/$populationID$/$generation$.genome', with the weights 'sw' saved next to it. Returns false,
+		// adding nothing, if the genome can't be loaded or doesn't take images of this size.
+		bool addGenome(uint populationID, uint generation);
+		uint getGenomeCount() const { return (uint)m_entries.size(); }
+
+		void run(Format format);
+	};
+}
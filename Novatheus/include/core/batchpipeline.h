@@ -0,0 +1,69 @@
+#pragma once
+#include "utils\utils.h"
+
+#include "core/dataset.h"
+#include "core/minibatchsampler.h"
+#include "core/augmenter.h"
+
+namespace Core {
+	// Prepares the minibatches a trainer takes, one for each of its lanes per step: a single lane for a Network, one per
+	// fold for a FoldNetwork. Each lane deals from a MinibatchSampler of its own and, when AUGMENT_TRAINING_SAMPLES is on,
+	// distorts its samples with an Augmenter of its own. Then one background thread prepares every lane, up to
+	// PIPELINE_PREFETCH_DEPTH steps ahead of the trainer. Without augmentation, dealing only points at samples already
+	// loaded, so acquire() does it inline and no thread is started.
+	// Slots are allocated up front, so neither side allocates once it is running. Lanes are prepared in order, each by
+	// one thread at a time, so a run repeats exactly however the threads are scheduled.
+	class BatchPipeline {
+	public:
+		struct Slot {
+			Batch m_batch;
+			uint m_epoch = 0u;				// Epochs the sampler had completed before dealing this minibatch.
+			bool m_endsEpoch = false;		// Whether this minibatch completed one.
+			std::vector<unsigned char> m_pixels; // The distorted samples' pixels, which m_batch points into. Empty without augmentation.
+		};
+	private:
+		struct Lane {
+			MinibatchSampler m_sampler;
+			std::unique_ptr<Augmenter> mp_augmenter; // Null without augmentation.
+			std::vector<Slot> m_slots; // Slot i % depth holds the lane's minibatch for step i.
+
+			Lane(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset, uint depth);
+		};
+
+		std::vector<Lane> m_lanes;
+		uint m_depth;			// Steps each lane has slots for.
+		uint m_batchCount;
+		uint m_produced = 0u;	// Steps prepared so far, in every lane.
+		uint m_consumed = 0u;	// Steps released by the trainer.
+		bool m_stopping = false;
+
+		std::mutex m_mutex;
+		std::condition_variable m_ready;	// Signalled when a step is produced.
+		std::condition_variable m_free;		// Signalled when one is released, or on stopping.
+		std::thread m_producer;				// Only started with augmentation.
+
+		std::chrono::steady_clock::duration m_waited {}; // Time the trainer spent waiting in acquire().
+
+		void start();
+		void produce();
+		void prepareStep(uint step);
+		static void prepare(Lane& lane, Slot& slot);
+
+		BatchPipeline(const BatchPipeline&) = delete;
+		BatchPipeline& operator=(const BatchPipeline&) = delete;
+	public:
+		// Prepares batchCount steps in all, then stops. Arguments are as for MinibatchSampler, for one lane or one per fold.
+		// Every lane needs samples to deal: check getEpochSampleCount() before the first acquire().
+		BatchPipeline(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset, uint batchCount);
+		BatchPipeline(const Dataset& dataset, const std::array<std::array<bool, CROSSVAL_COUNT>, CROSSVAL_COUNT>& testSections, const std::array<uint, CROSSVAL_COUNT>& batchOffsets, uint batchCount);
+		~BatchPipeline();
+
+		// The lane's minibatch for this step, waiting for it if it is not yet ready. It stays valid until release().
+		Slot& acquire(uint lane = 0u);
+		void release(); // Ends the step, for every lane.
+
+		uint getLaneCount() const { return (uint)m_lanes.size(); }
+		uint getEpochSampleCount(uint lane = 0u) const { return m_lanes[lane].m_sampler.getEpochSampleCount(); }
+		double getWaitedMilliseconds() const { return std::chrono::duration<double, std::milli>(m_waited).count(); }
+	};
+}
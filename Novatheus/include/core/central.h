@@ -2,6 +2,7 @@
 #include "utils\forwarder.h"
 #include "core\dataset.h"
 #include "core\network.h"
+#include "core/foldnetwork.h"
 
 namespace Core {
 	class CentralController {
@@ -36,7 +37,7 @@ namespace Core {
 		bool m_orderedToQuit = false;
 
 		template <class SquishifierType>
-		Core::Metrics trainTestAndCrossval(Core::Genome * genome, uint batches);
+		Core::Metrics trainTestAndCrossval(Core::Genome * genome, uint batches, uint threadCount = 1u); // Trains and tests every fold in lockstep across threadCount threads.
 	public:
 		CentralController();
 		~CentralController();
@@ -0,0 +1,30 @@
+#pragma once
+#include "core\dataset.h"
+
+namespace Core {
+	class Network;
+
+	// Writes a trained network out as one standalone, dependency-free C++ source file. The topology and weights become
+	// constexpr arrays, with rows padded so that the forward pass is a single branch-light loop over them and compiles in
+	// seconds even for large genomes. Weights are written as hex float literals, so nothing is lost in the export.
+	// Built with -DNOVATHEUS_CHECK, the file also gets a main() that replays EXPORT_CHECK_SAMPLES inputs against the outputs
+	// Network::runNetwork gave for them, and times the generated forward pass.
+	class CppExporter {
+	private:
+		Network& r_network;
+
+		std::vector<std::vector<float>> m_checkInputs;
+		std::vector<std::vector<float>> m_checkOutputs;
+
+		void collectCheckSamples(Dataset* dataset); // From the dataset's first batch, or random inputs if there is none.
+		void writeForward(std::ofstream & file, const std::string& name);
+		void writeCheck(std::ofstream & file, const std::string& name);
+	public:
+		CppExporter(Network& network) :
+			r_network(network) {}
+
+		// Returns false, writing nothing, if the network's squishifier has no generated equivalent or any weight or bias is
+		// nan or inf.
+		bool writeToFile(std::ofstream & file, Dataset* dataset, const std::string& name); // Name must be a valid C++ identifier.
+	};
+}
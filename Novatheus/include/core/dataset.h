@@ -1,21 +1,32 @@
 #pragma once
 
 #include "utils\utils.h"
+#include "core/idxfile.h"
 
 namespace Core {
+	// One image and its label, as a view into the dataset's arenas; it owns nothing. Inputs are decoded from the pixel bytes
+	// as a network loads them, and the 0.1/0.9 targets derived from the label.
 	class Sample {
 	public:
-		std::vector<float> m_inputs;
-		std::array<float, OUTPUT_COUNT> m_outputs {};
+		const unsigned char* p_pixels = nullptr;	// Dataset::m_sampleSize bytes, in Dataset::m_imageFile.
+		uint m_activeInputCount = 0u;				// Non-zero pixels.
+		unsigned char m_label = 0u;
+
+		float getInput(uint index) const;
+		float getTarget(uint output) const { return (output == m_label) ? 0.9f : 0.1f; }
+
+		// Calls function(index, input) for each non-zero input, in ascending order, for the skip-zero path. Blank pixels
+		// are skipped eight at a time.
+		template <class Function>
+		void forEachActiveInput(uint inputCount, Function function) const;
 	};
 
+	// MINIBATCH_COUNT samples. Only ever read once the dataset is loaded, so any number of networks may read one at once.
 	class Batch {
 	public:
 		std::array<Sample, MINIBATCH_COUNT> m_samples;
-		std::mutex * mp_inUse = nullptr;
 
-		Batch() { mp_inUse = new std::mutex; }
-		~Batch() { delete mp_inUse; }
+		uint m_activeInputCount = 0u;	// Total non-zero inputs across all samples.
 	};
 
 	class Section {
@@ -30,22 +41,29 @@ namespace Core {
 	private:
 		bool m_alreadyInitialised = false;
 
-		void readInt(std::ifstream & stream, int& target) {
-			stream.read((char*)&target, sizeof(int));
-			target = reverseInt(target);
-		}
-
-		int reverseInt(int i)
-		{
-			unsigned char c1, c2, c3, c4;
+		// The IDX files, mapped for as long as the dataset lives. The samples point straight into the images, which are one
+		// after another in the order the samples are partitioned, a byte a pixel against the four of the float it decodes to.
+		IdxFile m_imageFile;
+		IdxFile m_labelFile;
+		uint m_sampleSize = 0u;
 
-			c1 = i & 255;
-			c2 = (i >> 8) & 255;
-			c3 = (i >> 16) & 255;
-			c4 = (i >> 24) & 255;
+		// Starts every dataset cache file; then come the active input count and then the label of each sample, both in
+		// partition order. Any field that differs from what this build and these files would give makes the cache stale. The
+		// files' contents are not hashed: a retool reads them all anyway, so checking them would cost as much as it saves.
+		struct CacheHeader {
+			uint m_magic = DATASET_CACHE_MAGIC;
+			uint m_version = DATASET_CACHE_VERSION;
+			uint m_minibatchCount = MINIBATCH_COUNT;
+			uint m_crossvalCount = CROSSVAL_COUNT;
+			uint m_sampleSize = 0u;
+			uint m_batchesPerSection = 0u;
+			unsigned long long m_imageFileSize = 0ull, m_labelFileSize = 0ull;
+			long long m_imageWriteTime = 0ll, m_labelWriteTime = 0ll;
+		};
 
-			return ((int)c1 << 24) + ((int)c2 << 16) + ((int)c3 << 8) + c4;
-		}
+		uint retool(uint batchesPerSection); // Partitions the samples and counts their active inputs. Returns the empty images.
+		bool readCache(const std::string& path, CacheHeader& expected); // Partitions from the cache, if it is valid.
+		void writeCache(const std::string& path, const CacheHeader& header);
 
 	public:
 		Dataset() {};
@@ -55,6 +73,38 @@ namespace Core {
 
 		bool readIDXData(std::string dataFileName, int dataMagicNumber, std::string labelFileName, int labelMagicNumber);
 
+		// A pixel as a network input. Blank pixels stay 0, so the skip-zero path can skip them; the rest are scaled to 0.1 to
+		// 0.9, so as to avoid stressing the system.
+		static float pixelToInput(unsigned char pixel) { return (pixel == 0) ? 0.0f : (((float)pixel) * (0.8f / 255.0f)) + 0.1f; }
+		// pixelToInput of every byte, so that decoding is one load a pixel.
+		static const float* getPixelInputs();
+
+		uint getSampleSize() const { return m_sampleSize; }
+		uint getImageRows() const { return m_imageFile.getDimensions()[1]; }
+		uint getImageColumns() const { return m_imageFile.getDimensions()[2]; }
+		uint getSectionSampleCount() const { return m_data.empty() ? 0u : (uint)m_data[0].m_batches.size() * MINIBATCH_COUNT; }
+		// Samples are numbered section by section, in the order they were partitioned.
+		const Sample& getSample(uint index) const {
+			const uint sectionSamples = getSectionSampleCount();
+			return m_data[index / sectionSamples].m_batches[(index % sectionSamples) / MINIBATCH_COUNT].m_samples[index % MINIBATCH_COUNT];
+		}
+
 		bool getAlreadyInitialised() { return m_alreadyInitialised; }
 	};
+
+	inline float Sample::getInput(uint index) const { return Dataset::getPixelInputs()[p_pixels[index]]; }
+
+	template <class Function>
+	void Sample::forEachActiveInput(uint inputCount, Function function) const
+	{
+		const float* decode = Dataset::getPixelInputs();
+		uint i = 0;
+		for (; i + 8 <= inputCount; i += 8) {
+			unsigned long long block;
+			std::memcpy(&block, p_pixels + i, sizeof(block));
+			if (block == 0ull) { continue; }
+			for (uint j = i; j < i + 8; j++) { if (p_pixels[j] != 0) { function(j, decode[p_pixels[j]]); } }
+		}
+		for (; i < inputCount; i++) { if (p_pixels[i] != 0) { function(i, decode[p_pixels[i]]); } }
+	}
 }
\ No newline at end of file
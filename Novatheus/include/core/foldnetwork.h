@@ -0,0 +1,101 @@
+#pragma once
+#include "core\metrics.h"
+#include "core\squishifier.h"
+#include "core\dataset.h"
+#include "core/topology.h"
+#include "core/forwardjit.h"
+#include "utils/threadpool.h"
+#include "utils/ringbuffer.h"
+
+namespace Core {
+	class Genome;
+
+	// Trains all CROSSVAL_COUNT cross-validation folds of one genome in lockstep. The folds share one topology and differ only in
+	// their parameters and in which sections they read, so parameters are stored fold-interleaved and every edge's source index
+	// is loaded once for all folds; each fold's row is then streamed across its own minibatch as in Network::calculateBatch.
+	// Input edges are summed first, as in Network::runBatch: through the topology's input tiles for folds whose minibatch is
+	// dense, and by scattering only the non-zero inputs for folds whose minibatch is sparse. Folds sitting a step out are
+	// not computed at all.
+	// Each fold is dealt its minibatches, and keeps its rolling buffers and Metrics, as Network::trainFromDataset does.
+	class FoldNetwork : public Utils::HasForwarder {
+	public:
+		typedef std::array<bool, CROSSVAL_COUNT> SectionMask; // True for testing sections, as in Network::trainFromDataset.
+	private:
+		std::shared_ptr<const NetworkTopology> mp_topology;
+
+		uint m_inputCount;
+		uint m_outputCount;
+		uint m_valueBufferSize;
+		uint m_neuronCount;
+		uint m_edgeCount;
+
+		std::vector<float> m_weights;			// [edge * CROSSVAL_COUNT + fold].
+		std::vector<float> m_weightGradients;	// [edge * CROSSVAL_COUNT + fold]. Summed over the current minibatch.
+		std::vector<float> m_biases;			// [neuron * CROSSVAL_COUNT + fold].
+		std::vector<float> m_biasGradients;		// [neuron * CROSSVAL_COUNT + fold]. Summed over the current minibatch.
+
+		// Laid out [(row * CROSSVAL_COUNT + fold) * MINIBATCH_COUNT + sample].
+		std::vector<float> m_values;			// Per input and neuron.
+		std::vector<float> m_delAdelZ;			// Per neuron. Becomes delCdelZ during backprop.
+		std::vector<float> m_delCdelA;			// Per neuron.
+
+		std::array<Batch*, CROSSVAL_COUNT> mp_batches {}; // Minibatch each fold is on this step. Null for folds sitting it out.
+
+		// Skip-zero input path, per fold, as in Network. A fold whose minibatch is sparse this step leaves its input rows
+		// unloaded, and takes its input edge gradients from an input-major copy of its non-zero inputs once backprop is done.
+		std::array<bool, CROSSVAL_COUNT> m_sparseFolds {};
+		std::array<std::vector<uint>, CROSSVAL_COUNT> m_activeOffsets;	// Per fold. Size m_inputCount + 1.
+		std::array<std::vector<uint>, CROSSVAL_COUNT> m_activeSamples;
+		std::array<std::vector<float>, CROSSVAL_COUNT> m_activeValues;
+
+		Utils::ThreadPool* mp_threadPool = nullptr; // Null when running on the calling thread only.
+		Squishifier* mp_squishifier = nullptr;
+
+		// JIT-compiled weighted sums over every neuron-reading edge, run once per fold with that fold's rows. Null if not
+		// compiled; only used while AVX2 or AVX-512 kernels are selected, as in Network.
+		std::unique_ptr<const ForwardJit> mp_forwardJit;
+
+		// Activation kernel, bound once at construction to the instantiation for the squishifier's concrete type.
+		typedef void (*CalculateFunction)(FoldNetwork& network, uint index, const Squishifier& squishifier, bool prepForBackprop);
+		CalculateFunction mp_calculate = nullptr;
+
+		template <class SquishifierType>
+		static void calculate(FoldNetwork& network, uint index, const Squishifier& squishifier, bool prepForBackprop);
+		void runBackprop(uint index);
+		void endBatch(uint index, float learningRate);
+
+		std::array<Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES>, CROSSVAL_COUNT> m_costBuffer; // Rolling buffers over the last n minibatches, per fold. See Network.
+		std::array<Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES>, CROSSVAL_COUNT> m_CACostBuffer;
+		std::array<Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES>, CROSSVAL_COUNT> m_accuracyBuffer;
+
+		float m_startLRE, m_LRDelta, m_LRDeltaPerBatch;
+		uint m_trainedBatches = 0;
+
+		bool isWorthSplitting(uint level) const {
+			return mp_threadPool != nullptr && (unsigned long long)mp_topology->m_levelEdgeCounts[level] * CROSSVAL_COUNT * MINIBATCH_COUNT >= PARALLEL_LEVEL_MIN_WORK;
+		}
+		template <typename Func>
+		void forEachFold(Func& func) { // Folds are independent, so split them when there is more than one thread.
+			if (mp_threadPool != nullptr) { mp_threadPool->parallelFor(CROSSVAL_COUNT, func); }
+			else { func(0u, CROSSVAL_COUNT); }
+		}
+
+		void runBatches(bool prepForBackprop); // Loads each fold's minibatch from mp_batches and feeds them all forward.
+		void loadInputs(uint fold);
+		void runInputTile(uint tile, const uint* folds, uint foldCount); // Input-reading part of a tile's weighted sums, for the given folds.
+		void runSparseInputs(uint fold); // The same, for every input neuron of a skip-zero fold.
+		void transposeActiveInputs(uint fold); // See Network::transposeActiveInputs.
+		void accumulateSparseInputGradients(); // Input edge gradients of the skip-zero folds, once backprop has finished.
+		std::tuple<float, float, float> scoreFold(uint fold, bool setOutputDeltas); // Returns average cost, average correct-answer cost and accuracy.
+		void trainStep(float learningRate);
+	public:
+		FoldNetwork(Genome * source, std::shared_ptr<const NetworkTopology> topology, Squishifier* squishifier = nullptr, bool useJit = JIT_FORWARD_PASS); // Takes ownership of the squishifier.
+		~FoldNetwork();
+
+		void setThreadCount(uint threadCount); // 1 runs everything on the calling thread.
+		uint getThreadCount() const { return (mp_threadPool != nullptr) ? mp_threadPool->getThreadCount() : 1u; }
+
+		// Fold f trains for the given number of batches from batchOffsets[f], skipping crossvalidationSections[f], then tests on them.
+		std::array<Metrics, CROSSVAL_COUNT> trainFromDataset(Dataset* dataset, const std::array<SectionMask, CROSSVAL_COUNT>& crossvalidationSections, const std::array<uint, CROSSVAL_COUNT>& batchOffsets, uint batches);
+	};
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "utils\utils.h"
+
+namespace Core {
+	class NetworkTopology;
+
+	// x86-64 machine code for the weighted sums of a batched forward pass, compiled from a topology and the layout of the
+	// network that runs it. Each neuron gets a straight-line function: its MINIBATCH_COUNT sums are held in registers while
+	// one broadcast weight and one FMA per register go by for each edge, with every source row's offset baked in as a
+	// displacement, and are written back once at the end. Weights are still read from memory, so training can move them
+	// freely, and the sums are added in edge order, as the AVX2 and AVX-512 kernels add them.
+	// Needs AVX2 and FMA, and the System V calling convention, so not Windows. With JIT_PERF_MAP on Linux, each function is
+	// listed in /tmp/perf-<pid>.map, so perf can attribute samples to it; that file is only ever appended to, so turn it on
+	// only while profiling.
+	class ForwardJit {
+	public:
+		// sums[s] += weights[e * weightStride] * values[source * valueRowStride + s], over the neuron's compiled edges.
+		typedef void (*NeuronFunction)(const float* values, const float* weights, float* sums);
+
+		// Strides are in floats. With neuronEdgesOnly, edges that read inputs are left out, for layouts that sum those separately.
+		// Null if this machine or build can't run the code, or it would take more than JIT_MAX_CODE_MB. The reason
+		// is logged, the first time only when it holds for every call.
+		static std::unique_ptr<const ForwardJit> compile(const NetworkTopology& topology, uint valueRowStride, uint weightStride, bool neuronEdgesOnly);
+		~ForwardJit();
+
+		NeuronFunction getNeuronFunction(uint index) const { return m_neuronFunctions[index]; } // Null for neurons with no compiled edges.
+		size_t getCodeSize() const { return m_codeSize; }
+	private:
+		ForwardJit() = default;
+		ForwardJit(const ForwardJit&) = delete;
+		ForwardJit& operator=(const ForwardJit&) = delete;
+
+		void* mp_code = nullptr; // Executable, and read-only once compiled.
+		size_t m_codeSize = 0;
+		std::vector<NeuronFunction> m_neuronFunctions; // Per neuron.
+
+		void registerWithPerf(const std::vector<size_t>& offsets, uint layoutHash) const;
+	};
+}
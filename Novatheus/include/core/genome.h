@@ -23,6 +23,8 @@ namespace Core {
 	
 	class Genome : public Utils::HasForwarder {
 		friend class Network;
+		friend class NetworkTopology;
+		friend class FoldNetwork;
 	private:
 		uint m_inputCount;	// How many IDs are reserved at the front for input values.
 		uint m_outputCount; // How many of the rearmost neurons are read as the output.
@@ -0,0 +1,27 @@
+#pragma once
+#include "utils\utils.h"
+#include "utils/mappedfile.h"
+
+namespace Core {
+	// An IDX file of unsigned bytes (as MNIST's are), mapped rather than read in. The header is big-endian: a magic number,
+	// whose low byte is the number of dimensions, then each dimension's size. Items follow, one per step of the first
+	// dimension, each as many bytes as the product of the rest: one for a label, rows * columns for an image.
+	class IdxFile {
+	private:
+		Utils::MappedFile m_file;
+		std::vector<uint> m_dimensions;
+		const unsigned char* p_items = nullptr;
+		size_t m_itemSize = 0;
+	public:
+		// Logs the reason and returns false if the file can't be mapped, its magic number isn't the one expected, or it is
+		// shorter than its header says.
+		bool open(const std::string& path, int expectedMagicNumber);
+		void close();
+
+		uint getItemCount() const { return m_dimensions.empty() ? 0u : m_dimensions[0]; }
+		size_t getItemSize() const { return m_itemSize; }
+		const std::vector<uint>& getDimensions() const { return m_dimensions; }
+		size_t getFileSize() const { return m_file.getSize(); }
+		const unsigned char* getItem(uint index) const { return p_items + (size_t)index * m_itemSize; }
+	};
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "utils\utils.h"
+
+#include "core/network.h"
+
+#include <SFML/Network.hpp>
+
+namespace Core {
+	// Serves a trained network to local clients over TCP. Requests are gathered into minibatches of up to MINIBATCH_COUNT and
+	// run through Network::runInputsBatch; a minibatch goes as soon as it is full, or once its oldest request has waited
+	// SERVE_BATCH_WINDOW_US, so a lone client is not kept waiting for others. A minibatch too small to beat running its
+	// requests one at a time through Network::evaluate, as timed on startup, is run that way instead.
+	//
+	// Every message is a little-endian uint32 type, then its payload:
+	//  - 0, shape:		no payload.				Answered with uint32 inputCount, uint32 outputCount.
+	//  - 1, infer:		inputCount float32s.	Answered with uint32 argmax, then outputCount float32s.
+	//  - 2, stats:		no payload.				Answered with float32 p50 and p99 latency (us), float32 requests per second since
+	//											the server started, and uint32 requests served.
+	//  - 3, stop:		no payload.				Not answered. The server finishes the pending minibatch and returns.
+	// Latency is measured from a request being fully received to its answer being sent. Anything else closes the connection.
+	// Each connection's answers come back in the order of its messages: a shape or stats message sent behind infer
+	// messages still waiting for their minibatch runs that minibatch first.
+	// Sockets don't block: answers a client isn't reading yet are kept and sent as it takes them, so one slow client holds
+	// up no other, and one that leaves more than SERVE_MAX_UNSENT_BYTES unread is dropped.
+	class InferenceServer : public Utils::HasForwarder {
+	public:
+		enum MessageType : uint { Shape = 0u, Infer = 1u, Stats = 2u, Stop = 3u };
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Connection {
+			std::unique_ptr<sf::TcpSocket> mp_socket;
+			std::vector<char> m_received; // Bytes of messages not yet complete.
+			std::vector<char> m_unsent; // Bytes of answers the socket hasn't taken yet.
+			bool m_dropping = false; // Closed on the next pass of the serving loop.
+		};
+
+		struct Request {
+			Connection* p_connection; // Null once the client has gone.
+			Clock::time_point m_received;
+		};
+
+		Network& r_network;
+		unsigned short m_port;
+
+		sf::TcpListener m_listener;
+		sf::SocketSelector m_selector;
+		std::vector<std::unique_ptr<Connection>> m_connections;
+
+		// The minibatch being gathered. Request r's inputs are at [r * inputCount].
+		std::vector<Request> m_pending;
+		std::vector<float> m_batchInputs;
+		std::vector<float> m_batchOutputs;
+		EvaluationContext m_context; // For Network::evaluate, when too few requests are pending to be worth a minibatch.
+		uint m_batchFrom = 1u; // Fewest pending requests worth a minibatch, from calibrate().
+
+		std::vector<float> m_latencies; // Microseconds, of the last SERVE_LATENCY_WINDOW requests served, as a ring.
+		unsigned long long m_requestsServed = 0ull;
+		unsigned long long m_requestsBatched = 0ull;
+		unsigned long long m_batchesRun = 0ull;
+		Clock::time_point m_startTime;
+		bool m_stopping = false;
+
+		void calibrate(); // Times both paths on this network, to set m_batchFrom.
+		void accept();
+		bool receive(Connection& connection); // Returns false if the connection should be closed.
+		bool handleMessages(Connection& connection); // Returns false if the connection should be closed.
+		void close(size_t index);
+		void runPending();
+		void send(Connection& connection, const std::vector<char>& message); // Queues the message, then flushes.
+		void flush(Connection& connection); // Sends what the socket will take of the connection's unsent answers.
+		std::pair<float, float> getLatencyPercentiles() const; // p50, p99.
+		void logStats();
+	public:
+		InferenceServer(Network& network, unsigned short port = SERVE_DEFAULT_PORT);
+
+		// Serves until a client sends a stop message. Returns false if the port could not be listened on.
+		bool run();
+	};
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "utils\utils.h"
+#include "utils/bfloat16.h"
+
+namespace Core {
+	// The vector loops under the network kernels, built once per instruction set and picked at startup from CPUID, so one binary
+	// uses AVX2/FMA or AVX-512 where the machine has them and still runs everywhere else.
+	// The scalar set is the reference: plain loops, summing in order, matching what the kernels did before they were dispatched.
+	class Kernels {
+	public:
+		enum class Level { Scalar, SSE, AVX2, AVX512 };
+
+		typedef void (*MultiplyAddFunction)(float* target, const float* source, float multiplier, uint count);	// target[i] += multiplier * source[i].
+		typedef float (*DotFunction)(const float* a, const float* b, uint count);	// Sum of a[i] * b[i].
+		typedef float (*GatherDotFunction)(const float* values, const uint* indices, const float* weights, uint count);	// Sum of weights[i] * values[indices[i]].
+		typedef float (*GatherDotHalfFunction)(const float* values, const uint* indices, const Utils::BFloat16* weights, uint count);	// As GatherDotFunction, widening each weight.
+		typedef void (*MultiplyAddBytesFunction)(int* target, const unsigned char* source, int multiplier, uint count);	// target[i] += multiplier * source[i], for int8 multipliers.
+		typedef void (*UpdateFunction)(float* weights, float* gradients, float learningRate, float sampleCount, uint count);	// weights[i] -= (gradients[i] * learningRate) / sampleCount; gradients[i] = 0.
+
+		MultiplyAddFunction mp_multiplyAdd;
+		DotFunction mp_dot;
+		GatherDotFunction mp_gatherDot;
+		GatherDotHalfFunction mp_gatherDotHalf;
+		MultiplyAddBytesFunction mp_multiplyAddBytes;
+		UpdateFunction mp_update;
+
+		static const Kernels& get() { return s_active; }
+
+		static Level getBestSupported();
+		static Level getSelected() { return s_level; }
+		static bool select(Level level); // Returns false, changing nothing, if this machine can't run the level.
+		static const char* getName(Level level);
+	private:
+		static Kernels s_active;
+		static Level s_level;
+	};
+}
@@ -9,18 +9,27 @@ namespace Core {
 			m_testingBufferAverageCost,
 			m_testingBufferAverageCACost,
 			m_testingBufferAccuracy;
+
+		// Mixed-precision networks only: the same testing, run on the fp32 master weights for comparison. Zero otherwise.
+		float m_fullPrecisionTestingAverageCost,
+			m_fullPrecisionTestingAccuracy;
+
 		Metrics(float trainingBufferAverageCost = 0.0f,
 			float trainingBufferAverageCACost = 0.0f,
 			float trainingBufferAccuracy = 0.0f,
 			float testingBufferAverageCost = 0.0f,
 			float testingBufferAverageCACost = 0.0f,
-			float testingBufferAccuracy = 0.0f) :
+			float testingBufferAccuracy = 0.0f,
+			float fullPrecisionTestingAverageCost = 0.0f,
+			float fullPrecisionTestingAccuracy = 0.0f) :
 			m_trainingBufferAverageCost(trainingBufferAverageCost),
 			m_trainingBufferAverageCACost(trainingBufferAverageCACost),
 			m_trainingBufferAccuracy(trainingBufferAccuracy),
 			m_testingBufferAverageCost(testingBufferAverageCost),
 			m_testingBufferAverageCACost(testingBufferAverageCACost),
-			m_testingBufferAccuracy(testingBufferAccuracy) {}
+			m_testingBufferAccuracy(testingBufferAccuracy),
+			m_fullPrecisionTestingAverageCost(fullPrecisionTestingAverageCost),
+			m_fullPrecisionTestingAccuracy(fullPrecisionTestingAccuracy) {}
 
 		Metrics operator+(Metrics& other) {
 			return Metrics(
@@ -29,7 +38,9 @@ namespace Core {
 				(m_trainingBufferAccuracy + other.m_trainingBufferAccuracy),
 				(m_testingBufferAverageCost + other.m_testingBufferAverageCost),
 				(m_testingBufferAverageCACost + other.m_testingBufferAverageCACost),
-				(m_testingBufferAccuracy + other.m_testingBufferAccuracy)
+				(m_testingBufferAccuracy + other.m_testingBufferAccuracy),
+				(m_fullPrecisionTestingAverageCost + other.m_fullPrecisionTestingAverageCost),
+				(m_fullPrecisionTestingAccuracy + other.m_fullPrecisionTestingAccuracy)
 			);
 		}
 
@@ -40,7 +51,9 @@ namespace Core {
 				(m_trainingBufferAccuracy		/ divisor),
 				(m_testingBufferAverageCost		/ divisor),
 				(m_testingBufferAverageCACost	/ divisor),
-				(m_testingBufferAccuracy		/ divisor)
+				(m_testingBufferAccuracy		/ divisor),
+				(m_fullPrecisionTestingAverageCost	/ divisor),
+				(m_fullPrecisionTestingAccuracy	/ divisor)
 			);
 		}
 	};
@@ -0,0 +1,29 @@
+#pragma once
+#include "utils\utils.h"
+
+#include "core/dataset.h"
+
+namespace Core {
+	// Deals the minibatches one network, or one fold of a FoldNetwork, trains on. An epoch is every sample of the training
+	// sections once, in an order reshuffled at the start of each epoch by the sampler's own generator, seeded from its batch
+	// offset, so that each fold sees its own sequence and a run repeats exactly. The dataset is only read and each sampler
+	// keeps its own position, so any number may deal at once with no locks between them.
+	// With SHUFFLE_TRAINING_SAMPLES off, the partitioned minibatches are dealt in order from the batch offset instead.
+	class MinibatchSampler {
+	private:
+		const Dataset& r_dataset;
+		std::vector<uint> m_order; // Dataset sample indices of the training sections, in this epoch's order.
+		std::mt19937 m_rng;
+		uint m_position = 0u; // Next in m_order.
+		uint m_epoch = 0u;
+	public:
+		// testSections as in Network::trainFromDataset: true for the sections not to train on.
+		MinibatchSampler(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset);
+
+		// Fills batch with the next MINIBATCH_COUNT samples. One that runs past the end of an epoch carries on into the next.
+		void next(Batch& batch);
+
+		uint getEpoch() const { return m_epoch; } // Epochs completed.
+		uint getEpochSampleCount() const { return (uint)m_order.size(); }
+	};
+}
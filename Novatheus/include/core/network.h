@@ -4,12 +4,32 @@
 #include "core\squishifier.h"
 #include "core\dataset.h"
 #include "core/genome.h"
+#include "core/topology.h"
+#include "core/forwardjit.h"
+#include "utils/threadpool.h"
+#include "utils/bfloat16.h"
+#include "utils/span.h"
+#include "utils/ringbuffer.h"
 
 namespace Core {
 	class Genome;
+	class Network;
+
+	// Working memory for Network::evaluate, owned by the caller: one per thread, reused from call to call. Grows to fit the
+	// largest network it is used with, so only the first call with a given network can allocate.
+	class EvaluationContext {
+		friend class Network;
+	private:
+		std::vector<float> m_values; // Inputs, then neuron outputs, as Network::mp_valueBuffer.
+	public:
+		EvaluationContext() = default;
+		explicit EvaluationContext(const Network& network); // Sized for the network up front, so no call allocates.
+	};
 	
 	class Network : public Utils::HasForwarder {
 		friend class Neuron;
+		friend class QuantizedNetwork;
+		friend class CppExporter;
 	protected:
 		Genome* p_source;
 
@@ -19,26 +39,161 @@ namespace Core {
 		uint m_valueBufferSize;
 
 		uint m_neuronCount;
-		std::vector<Neuron> m_neurons;
+		uint m_edgeCount;
+		uint m_levelCount;
+
+		// Structure, shared with every other network built from the same genome. The counts above are copied out of it.
+		std::shared_ptr<const NetworkTopology> mp_topology;
+
+		// Parameters, in the topology's flat (CSR) layout. Kept as separate arrays so the forward pass never drags gradient bytes through the cache.
+		std::vector<float> m_weights;			// Per edge.
+		std::vector<float> m_weightGradients;	// Per edge. Summed over the current minibatch.
+		std::vector<float> m_biases;			// Per neuron.
+		std::vector<float> m_biasGradients;		// Per neuron. Summed over the current minibatch.
+		std::vector<float> m_delAdelZ;			// Per neuron. Change in neuron output over change in weighted sum.
+		std::vector<float> m_delCdelA;			// Per neuron. Change in cost over change in neuron output.
+
+		// Mixed-precision mode. The forward and backward passes read a bf16 copy of the weights, half the bytes per edge,
+		// while gradients are still summed and applied in fp32 to m_weights, which stays the master copy.
+		bool m_mixedPrecision = false;
+		std::vector<Utils::BFloat16> m_hotWeights;	// Per edge. Empty unless m_mixedPrecision. Refreshed by Neuron::endBatch.
+
+		float getHotWeight(uint edge) const { return m_mixedPrecision ? m_hotWeights[edge].toFloat() : m_weights[edge]; } // The weight the passes use.
+
+		// JIT-compiled sums over calculateBatch's neuron-reading edges. Only run over whole minibatches, on fp32 weights, while
+		// AVX2 or AVX-512 kernels are selected, as the kernels' summing order then matches it; the kernels run everything else.
+		// Off by default: each function runs once per minibatch, and for large genomes streaming the code in costs more than
+		// it saves. FoldNetwork runs each one for every fold in turn, which is where it pays.
+		bool m_useJit = false;
+		std::unique_ptr<const ForwardJit> mp_forwardJit;
+		const ForwardJit* getActiveJit() const; // Null when the kernels should run.
+
+		Utils::ThreadPool* mp_threadPool = nullptr; // Null when running on the calling thread only.
+
+		// Sample-parallel mode. Rather than splitting each level's neurons, each pool thread takes a contiguous range of the
+		// minibatch's samples through the whole network and accumulates its own gradients: thread 0 into m_weightGradients and
+		// m_biasGradients, the others into the slices below. endBatch folds the slices in thread order, so results are
+		// reproducible for a given thread count.
+		bool m_splitSamples = false;
+		std::vector<float> m_workerWeightGradients;	// (threadCount - 1) * m_edgeCount.
+		std::vector<float> m_workerBiasGradients;	// (threadCount - 1) * m_neuronCount.
+
+		// Batched evaluation buffers, laid out [row * MINIBATCH_COUNT + sample] so that each neuron
+		// evaluates its weighted sum for a whole minibatch per weight load.
+		std::vector<float> m_batchDelAdelZ;		// Per neuron, per sample.
+		std::vector<float> m_batchDelCdelA;		// Per neuron, per sample.
+
+		// Skip-zero input path. When the loaded minibatch went through it, input rows of mp_batchValueBuffer are not filled,
+		// and its non-zero inputs are kept here instead, transposed to input-major for the input gradient pass.
+		bool m_useSparseInputs = true;
+		bool m_batchIsSparse = false;
+		std::vector<uint> m_batchActiveOffsets;	// Size m_inputCount + 1.
+		std::vector<uint> m_batchActiveSamples;
+		std::vector<float> m_batchActiveValues;
 
 		Squishifier* mp_squishifier = nullptr;
 
-		std::list<float> m_costBuffer; // Used for tracking a rolling buffer of costs over the last n minibatches.
-		std::list<float> m_CACostBuffer; // Used for tracking a rolling buffer of correct-answer costs over the last n minibatches.
-		std::list<float> m_accuracyBuffer; // Used for tracking a rolling buffer of accuracy over the last n minibatches, in the form of percentage of samples answered correctly.
+		// Activation kernels, bound once at construction to the Neuron instantiation for the squishifier's concrete type.
+		typedef float (*CalculateFunction)(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop);
+		typedef void (*CalculateBatchFunction)(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop, uint sampleBegin, uint sampleEnd);
+		typedef float (*EvaluateFunction)(const Network& network, uint index, const Squishifier& squishifier, const float* values);
+		CalculateFunction mp_calculate = nullptr;
+		CalculateBatchFunction mp_calculateBatch = nullptr;
+		EvaluateFunction mp_evaluate = nullptr;
+
+		template <class SquishifierType>
+		static float calculateAs(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop) {
+			return Neuron::calculate<SquishifierType>(network, index, static_cast<const SquishifierType&>(squishifier), prepForBackprop);
+		}
+		template <class SquishifierType>
+		static void calculateBatchAs(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop, uint sampleBegin, uint sampleEnd) {
+			Neuron::calculateBatch<SquishifierType>(network, index, static_cast<const SquishifierType&>(squishifier), prepForBackprop, sampleBegin, sampleEnd);
+		}
+		template <class SquishifierType>
+		static float evaluateAs(const Network& network, uint index, const Squishifier& squishifier, const float* values) {
+			return Neuron::evaluate<SquishifierType>(network, index, static_cast<const SquishifierType&>(squishifier), values);
+		}
+		template <class SquishifierType>
+		void bindKernels() {
+			mp_calculate = &Network::calculateAs<SquishifierType>;
+			mp_calculateBatch = &Network::calculateBatchAs<SquishifierType>;
+			mp_evaluate = &Network::evaluateAs<SquishifierType>;
+		}
+
+		Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES> m_costBuffer; // Used for tracking a rolling buffer of costs over the last n minibatches.
+		Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES> m_CACostBuffer; // Used for tracking a rolling buffer of correct-answer costs over the last n minibatches.
+		Utils::RingBuffer<float, TRAINING_BUFFER_BATCHES> m_accuracyBuffer; // Used for tracking a rolling buffer of accuracy over the last n minibatches, in the form of percentage of samples answered correctly.
 
 		float m_startLRE, m_LRDelta, m_LRDeltaPerBatch;
 		uint m_trainedBatches = 0;
+
+		bool isWorthSplitting(uint level, uint width) const {
+			return mp_threadPool != nullptr && (unsigned long long)mp_topology->m_levelEdgeCounts[level] * width >= PARALLEL_LEVEL_MIN_WORK;
+		}
+		// First sample of a sample-parallel worker's share, on a multiple of SAMPLE_CHUNK_ALIGNMENT. Worker count is its end.
+		static uint getSampleChunkBegin(uint workers, uint worker) {
+			const uint chunks = (MINIBATCH_COUNT + SAMPLE_CHUNK_ALIGNMENT - 1) / SAMPLE_CHUNK_ALIGNMENT;
+			return std::min(Utils::ThreadPool::getChunkBegin(chunks, workers, worker) * SAMPLE_CHUNK_ALIGNMENT, MINIBATCH_COUNT);
+		}
+
+		void runBatch(Batch& batch, bool prepForBackprop); // Loads a minibatch into mp_batchValueBuffer and feeds it forward.
+		void runInputBlockBatch(); // Input-reading part of every neuron's weighted sum, for the minibatch already loaded.
+		void runLevelsBatch(bool prepForBackprop); // The rest of the forward pass, one level at a time, once the input block has run.
+		void loadInputsBatch(Batch& batch, uint sampleBegin, uint sampleEnd); // Transposes the samples' inputs into the input rows of mp_batchValueBuffer.
+		void runSparseInputBlockBatch(Batch& batch, uint sampleBegin, uint sampleEnd); // As runInputBlockBatch, iterating only the non-zero inputs of each sample.
+		void transposeActiveInputs(Batch& batch); // Input-major copy of a skip-zero minibatch's non-zero inputs, for accumulateSparseInputGradients.
+		void runSampleRange(Batch& batch, bool prepForBackprop, uint sampleBegin, uint sampleEnd); // The whole forward pass, for some samples only.
+		void backpropSampleRange(uint worker, uint sampleBegin, uint sampleEnd); // The whole backward pass, for some samples only, into the worker's gradients.
+		void accumulateSparseInputGradients(); // Input edge gradients for a skip-zero minibatch, once backprop has finished.
+		void backpropBatch(); // Runs backwards over the minibatch, from output deltas already set in m_batchDelCdelA.
 	public:
-		Network(Genome * source, Squishifier* squishifier = nullptr);
+		Network(Genome * source, std::shared_ptr<const NetworkTopology> topology, Squishifier* squishifier = nullptr); // Runtime-polymorphic. Known squishifiers still get their specialised kernels.
+		Network(Genome * source, Squishifier* squishifier = nullptr) : // Builds a topology of its own.
+			Network(source, std::make_shared<const NetworkTopology>(source), squishifier) {}
+		template <class SquishifierType>
+		Network(Genome * source, std::shared_ptr<const NetworkTopology> topology, SquishifierType* squishifier); // Activation resolved at compile time. Instantiated at the bottom of network.cpp.
+		template <class SquishifierType>
+		Network(Genome * source, SquishifierType* squishifier) :
+			Network(source, std::make_shared<const NetworkTopology>(source), squishifier) {}
 		~Network();
 
 		float* mp_valueBuffer = nullptr; // C-array of values, used to store neuron outputs when feeding forward.
+		float* mp_batchValueBuffer = nullptr; // C-array of values for a whole minibatch, [value * MINIBATCH_COUNT + sample].
 
 		uint getInputCount() const { return m_inputCount; }
 		uint getOutputCount() const { return m_outputCount; }
+		uint getValueBufferSize() const { return m_valueBufferSize; }
+		uint getLevelCount() const { return m_levelCount; }
+		std::shared_ptr<const NetworkTopology> getTopology() const { return mp_topology; }
+
+		void setUseSparseInputs(bool useSparseInputs) { m_useSparseInputs = useSparseInputs; }
+		bool getUseSparseInputs() const { return m_useSparseInputs; }
+
+		void setMixedPrecision(bool mixedPrecision); // See m_mixedPrecision. Testing reports the fp32 master weights' results alongside.
+		bool getMixedPrecision() const { return m_mixedPrecision; }
+
+		void setUseJit(bool useJit); // See m_useJit. Compiles, if that hasn't already happened.
+		bool getUseJit() const { return m_useJit; }
+
+		void setThreadCount(uint threadCount, bool splitSamples = false); // Threads used to evaluate each level, or each share of the minibatch. 1 runs everything on the calling thread.
+		uint getThreadCount() const { return (mp_threadPool != nullptr) ? mp_threadPool->getThreadCount() : 1u; }
+		bool getSplitSamples() const { return m_splitSamples; }
+		uint getSampleWorkerCount() const { return m_splitSamples ? getThreadCount() : 1u; }
+
+		// Trained parameters, for files next to the genome's. Reading fails, changing nothing, if the file was written for another layout.
+		void writeWeightsToFile(std::ofstream & file);
+		bool readWeightsFromFile(std::ifstream & file);
 
 		std::vector<float> runNetwork(std::vector<float>& inputs, bool prepForBackprop = false);
+		// Feeds one sample forward, on the calling thread, through the caller's context rather than mp_valueBuffer. Reads the
+		// network's parameters and nothing else of it, so any number of threads can evaluate one network at once, each with
+		// its own context, as long as nothing trains or reconfigures it meanwhile. Allocates nothing once the context fits.
+		// Returns false, writing nothing, if the spans' sizes are not the network's input and output counts.
+		bool evaluate(Utils::Span<const float> inputs, Utils::Span<float> outputs, EvaluationContext& context) const;
+		// Feeds up to MINIBATCH_COUNT samples forward as one minibatch, through the batched kernels. Inputs are laid out
+		// [sample * inputCount + input] and outputs [sample * outputCount + output]. A partial minibatch runs only its own
+		// samples, single-threaded, so a lone request costs a fraction of a full one.
+		void runInputsBatch(const float* inputs, uint sampleCount, float* outputs);
 
 		std::tuple<float, float, float> trainFromBatch(Batch& batch); // Returns average cost and total correct answers.
 		std::tuple<float, float, float> testFromBatch(Batch& batch); // Returns average cost and total correct answers.
@@ -7,59 +7,32 @@
 namespace Core {
 	class Network;
 
+	// Neurons no longer own any state; a neuron is simply a row of the network's flat (CSR) arrays.
+	// These are the per-row kernels that run over that layout.
+	// The activation kernels are templated on the squishifier, so a concrete (final) type gets inlined and vectorised,
+	// while SquishifierType = Squishifier falls back to virtual calls. Instantiated at the bottom of neuron.cpp.
 	class Neuron {
 	public:
-		class Weight {
-		public:
-			unsigned int m_valueAddress; // Offset from start of Network::mp_valueBuffer
-			unsigned int m_neuronAddress; // Offset from start of Network::m_neurons
-			bool m_isInput = false;
-			float m_weight;
-
-			float m_currentBatchAverageGradient = 0.0f;
-
-			Weight(unsigned int valueAddress, int neuronAddress, float weight) :
-				m_valueAddress(valueAddress),
-				m_weight(weight)
-			{
-				if (neuronAddress < 0) {
-					m_isInput = true;
-					m_neuronAddress = 0;
-				}
-				else { m_neuronAddress = (uint)neuronAddress; }
-			};
-
-			void addGradientForSample(float sample) {
-				m_currentBatchAverageGradient += sample;
-			}
-
-			void endBatch(float learningRate, uint totalSampleCountInBatch) {
-				m_weight -= (m_currentBatchAverageGradient * learningRate) / (float)totalSampleCountInBatch;
-				m_currentBatchAverageGradient = 0.0f;
-			}
-		};
-	protected:
-		Network* p_parent;
-
-		std::vector<Neuron::Weight> m_weights;
-		float m_bias;
-		float m_biasCurrentBatchCombinedGradient = 0.0f;
-
-		float m_delAdelZ = 0.0f; // Change in neuron output over change in weighted sum. Calculated using inverse squishification func.
-		float m_delCdelA = 0.0f; // Change in cost over change in neuron output.
-	public:
-		Neuron(Network * parent, const Chromosome & chromosome, std::map<uint, uint> & idsToIndices);
-		~Neuron();
-
-		float calculate(Squishifier* squishifier, bool prepForBackprop = true);
-
-		float getBias() const { return m_bias; }
-		Neuron& setBias(float newBias) { m_bias = newBias; return *this; }
-
-		void setDelCdelA(float delCdelA) {
-			m_delCdelA = delCdelA;
-		}
-		void runBackprop();
-		void endBatch(float learningRate, uint totalSampleCountInBatch);
+		template <class SquishifierType>
+		static float calculate(Network& network, uint index, const SquishifierType& squishifier, bool prepForBackprop = true);
+		// As calculate, over the given value array rather than Network::mp_valueBuffer, touching nothing of the network's.
+		template <class SquishifierType>
+		static float evaluate(const Network& network, uint index, const SquishifierType& squishifier, const float* values);
+
+		// Minibatch kernels, operating on Network::mp_batchValueBuffer, over samples [sampleBegin, sampleEnd) only.
+		// calculateInputTileBatch writes the input-reading part of a tile's weighted sums into their value rows;
+		// calculateBatch then finishes each neuron from there, over its neuron-reading edges only.
+		static void calculateInputTileBatch(Network& network, uint tile, uint sampleBegin = 0u, uint sampleEnd = MINIBATCH_COUNT);
+		template <class SquishifierType>
+		static void calculateBatch(Network& network, uint index, const SquishifierType& squishifier, bool prepForBackprop = true, uint sampleBegin = 0u, uint sampleEnd = MINIBATCH_COUNT);
+		// Gathers delCdelA from the neuron's consumers, then only writes the neuron's own rows and gradients
+		// (its delAdelZ row becomes delCdelZ), so a whole level can run in parallel.
+		// Gradients are added to the given per-edge and per-neuron arrays, so sample ranges can accumulate separately.
+		static void runBackpropBatch(Network& network, uint index, float* weightGradients, float* biasGradients, uint sampleBegin = 0u, uint sampleEnd = MINIBATCH_COUNT);
+
+		// Folds in any per-thread gradients from sample-parallel training, in thread order, before applying the update.
+		static void endBatch(Network& network, uint index, float learningRate, uint totalSampleCountInBatch);
+	private:
+		static float getWeightedSum(const Network& network, uint index, const float* values); // Bias included.
 	};
-}
\ No newline at end of file
+}
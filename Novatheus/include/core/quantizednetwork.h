@@ -0,0 +1,55 @@
+#pragma once
+#include "core\squishifier.h"
+#include "core\dataset.h"
+#include "core/topology.h"
+
+namespace Core {
+	class Network;
+
+	// Forward-only int8 copy of a trained Network, for inference. Every value (input or neuron output) is stored as a uint8
+	// with its own scale, calibrated from the largest value that row reached over some calibration minibatches; every
+	// squishifier here is bounded below by 0, so values need no zero point. Each edge's weight has its source's scale folded
+	// in before the weight is quantized to int8 with a per-neuron scale, so a neuron's weighted sum is one int32 dot product
+	// of raw bytes, rescaled once. Output neurons also keep their fp32 activations, for scoring.
+	class QuantizedNetwork : public Utils::HasForwarder {
+	private:
+		std::shared_ptr<const NetworkTopology> mp_topology;
+
+		uint m_inputCount;
+		uint m_outputCount;
+		uint m_valueBufferSize;
+		uint m_neuronCount;
+		uint m_edgeCount;
+
+		std::vector<signed char> m_weights;		// Per edge. Source's activation scale folded in.
+		std::vector<float> m_weightScales;		// Per neuron.
+		std::vector<float> m_biases;			// Per neuron.
+		std::vector<float> m_valueScales;		// Per input and neuron. Real value of a stored 1.
+		std::vector<float> m_inverseValueScales;
+
+		std::vector<unsigned char> m_values;	// Per input and neuron, [row * MINIBATCH_COUNT + sample].
+		std::vector<float> m_outputs;			// Per output, [output * MINIBATCH_COUNT + sample]. Unquantized.
+
+		Squishifier* mp_squishifier = nullptr;
+
+		// Activation kernel, bound once at construction to the instantiation for the squishifier's concrete type.
+		typedef void (*CalculateFunction)(QuantizedNetwork& network, uint index, const Squishifier& squishifier);
+		CalculateFunction mp_calculate = nullptr;
+
+		template <class SquishifierType>
+		static void calculate(QuantizedNetwork& network, uint index, const Squishifier& squishifier);
+
+		void calibrate(Network& source, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& calibrationSections, uint calibrationBatches);
+		void quantizeWeights(Network& source);
+		void runBatch(Batch& batch);
+	public:
+		// Calibrates on up to calibrationBatches minibatches from the given sections, run through the source network.
+		QuantizedNetwork(Network& source, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& calibrationSections, uint calibrationBatches = QUANTIZATION_CALIBRATION_BATCHES, Squishifier* squishifier = nullptr); // Takes ownership of the squishifier. Without one, uses the source's type.
+		~QuantizedNetwork();
+
+		std::tuple<float, float, float> testFromBatch(Batch& batch); // Returns average cost, average correct-answer cost and accuracy, as Network::testFromBatch.
+
+		// Tests both networks on the given sections and logs the quantized network's drift from the fp32 one.
+		void reportDrift(Network& reference, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& testSections);
+	};
+}
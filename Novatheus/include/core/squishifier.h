@@ -7,12 +7,14 @@ namespace Core {
 	public:
 		virtual float squish(float input) const = 0;
 		virtual float getDerivative(float input) const = 0;
+		virtual Squishifier* clone() const = 0; // A new one of the same type, for another network to own.
 
 		virtual ~Squishifier() {};
 	};
 
 	// A quick and dirty squishifier, bounded between 0 and 1.
-	class FastSigmoid : public Squishifier {
+	// Final, so that kernels templated on it can inline squish/getDerivative rather than calling virtually.
+	class FastSigmoid final : public Squishifier {
 	public:
 		float squish(float input) const override {
 			// std::abs only works for longs, not floats. FFS.
@@ -32,6 +34,8 @@ namespace Core {
 			return (0.5f / (t * t));
 		}
 
+		FastSigmoid* clone() const override { return new FastSigmoid(); }
+
 		FastSigmoid() : Squishifier() {};
 		~FastSigmoid() override {};
 	};
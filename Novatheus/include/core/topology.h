@@ -0,0 +1,71 @@
+#pragma once
+#include "utils\utils.h"
+
+namespace Core {
+	class Genome;
+
+	// Everything about a network that follows from its genome's structure alone: the flat (CSR) edge layout and the views
+	// derived from it. Built once per genome and never modified afterwards, so every Network evaluating the same genome
+	// (eg. the folds of trainTestAndCrossval) can share one through a std::shared_ptr<const NetworkTopology>,
+	// keeping only its own parameters and working state.
+	class NetworkTopology {
+	public:
+		uint m_inputCount;
+		uint m_outputCount;
+		uint m_neuronCount;
+		uint m_edgeCount;
+		uint m_valueBufferSize;
+
+		// Neuron i owns edges [m_rowOffsets[i], m_rowOffsets[i + 1]).
+		std::vector<uint> m_rowOffsets;			// Size m_neuronCount + 1.
+		std::vector<uint> m_sourceIndices;		// Per edge. Offset from start of the value buffer.
+
+		// The genome's parameters, in the same layout. Each network copies these as its starting point.
+		std::vector<float> m_startingWeights;	// Per edge.
+		std::vector<float> m_startingBiases;	// Per neuron.
+
+		// Input block. In batched mode, edges that read inputs are run up front as one block-sparse product over the input rows:
+		// input-reading neurons are tiled INPUT_TILE_NEURONS at a time and each tile's input edges are sorted by input, so that
+		// an input row is streamed once per tile. Results land in each neuron's own value row, which calculateBatch then finishes.
+		std::vector<uint> m_rowSplits;			// Per neuron. Edges [m_rowOffsets[i], m_rowSplits[i]) read inputs, the rest read neurons.
+		std::vector<uint> m_inputNeurons;		// Neurons that read at least one input, ascending. Tile t is [t * INPUT_TILE_NEURONS, ...).
+		std::vector<uint> m_inputTileOffsets;	// Size tileCount + 1. Entry range of each tile.
+		std::vector<uint> m_inputTileEdges;		// Per input edge, sorted by input within its tile.
+		std::vector<uint> m_inputTileNeurons;	// Per input edge. Neuron that owns it.
+
+		// Fan-out of each input, for the skip-zero input path. Input p is read by edges m_inputFanOutEdges[m_inputFanOutOffsets[p] ...),
+		// owned by neurons m_inputFanOutNeurons[...].
+		std::vector<uint> m_inputFanOutOffsets;	// Size m_inputCount + 1.
+		std::vector<uint> m_inputFanOutEdges;
+		std::vector<uint> m_inputFanOutNeurons;
+
+		// Transposed (fan-out) view of the same edges. Neuron i is read by edges m_fanOutEdges[m_fanOutOffsets[i] .. m_fanOutOffsets[i + 1]),
+		// which belong to neurons m_fanOutNeurons[...]. Lets the backward pass gather rather than scatter.
+		std::vector<uint> m_fanOutOffsets;		// Size m_neuronCount + 1.
+		std::vector<uint> m_fanOutEdges;		// Per neuron-to-neuron edge. Index into the per-edge arrays.
+		std::vector<uint> m_fanOutNeurons;		// Per neuron-to-neuron edge. Consuming neuron.
+
+		// Topological levels. A neuron's level is one more than the deepest neuron it reads from (input-only neurons are level 0),
+		// so the neurons within a level never depend on one another and can be evaluated as one wavefront.
+		uint m_levelCount;
+		std::vector<uint> m_levelOffsets;		// Size m_levelCount + 1.
+		std::vector<uint> m_levelNeurons;		// Neuron indices, grouped by level, ascending within each.
+		std::vector<uint> m_levelEdgeCounts;	// Per level.
+
+		// FNV-1a over the row offsets and source indices. Trained weights are only meaningful against the same layout, which
+		// also depends on LOCALITY_REORDERING, so weight files carry this to be checked on loading.
+		uint m_layoutHash;
+
+		NetworkTopology(Genome * source, bool reorderForLocality = LOCALITY_REORDERING);
+	private:
+		// Permutes the neurons into level order, clustered by where they read from, so that consecutive gathers land near one another.
+		// Logs the change in locality, and leaves the genome's order alone if there is none.
+		void reorderNeurons();
+		std::vector<uint> getNeuronLevels() const;
+		std::pair<uint, float> getGatherLocality(const std::vector<uint>& levels) const; // Input rows streamed by the input block, and mean jump between consecutive neuron gathers.
+
+		void buildInputBlock();
+		void buildFanOut();
+		void buildLevels();
+	};
+}
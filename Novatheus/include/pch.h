@@ -6,8 +6,13 @@
 #include <set>
 #include <queue>
 #include <future>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 #include <cmath>
+#include <limits>
+#include <cstdio> // snprintf
 #include <string>
 #include <random>
 #include <fstream>	// File stream.
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+
+namespace Utils {
+	// Debug builds replace the global operator new, counting heap allocations across the whole process, so a hot loop can
+	// check that it makes none, on its own thread or any it hands work to. Release builds keep the standard allocator and
+	// always read 0.
+	class AllocationCounter {
+	public:
+		static size_t getCount(); // Allocations made by every thread so far.
+		static constexpr bool isEnabled() {
+#ifdef DEBUG
+			return true;
+#else
+			return false;
+#endif
+		}
+	};
+}
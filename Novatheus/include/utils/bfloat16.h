@@ -0,0 +1,25 @@
+#pragma once
+#include <cstring>
+
+namespace Utils {
+	// bfloat16: the top half of an IEEE float. Same exponent range as a float, with 8 bits of mantissa rather than 24,
+	// so widening is a shift and nothing that fits a float overflows. Used for the hot copy of mixed-precision weights.
+	struct BFloat16 {
+		unsigned short m_bits = 0;
+
+		BFloat16() = default;
+		explicit BFloat16(float value) {
+			unsigned int bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			if ((bits & 0x7FFFFFFFu) > 0x7F800000u) { m_bits = (unsigned short)((bits >> 16) | 0x0040u); } // Keep NaNs quiet, rather than rounding them to infinity.
+			else { m_bits = (unsigned short)((bits + 0x7FFFu + ((bits >> 16) & 1u)) >> 16); } // Round to nearest, ties to even.
+		}
+
+		float toFloat() const {
+			unsigned int bits = (unsigned int)m_bits << 16;
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+	};
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+namespace Utils {
+	// Instruction set extensions usable on this machine: supported by the CPU, and with their register state saved by the OS.
+	// Read from CPUID once, on first use.
+	class CpuFeatures {
+	public:
+		bool m_sse2 = false;
+		bool m_avx = false;
+		bool m_avx2 = false;
+		bool m_fma = false;
+		bool m_avx512f = false;
+
+		static const CpuFeatures& get();
+	private:
+		CpuFeatures();
+	};
+}
@@ -54,7 +54,7 @@ namespace Utils {
 		{};
 	public:
 		inline Forwarder * getForwarder() { return mp_forwarder; }
-		inline unsigned int getID() { return m_id; }
+		inline unsigned int getID() const { return m_id; }
 
 		inline std::default_random_engine * getRNG() { return mp_forwarder->p_rng; }
 		inline Utils::AssetManager * getAssetManager() { return mp_forwarder->p_assetManager; }
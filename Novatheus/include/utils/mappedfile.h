@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace Utils {
+	// A whole file mapped read-only into memory, so it can be read in place, by any number of threads, without copying it in
+	// first. Pages are read from disk as they are first touched.
+	class MappedFile {
+	private:
+		const unsigned char* p_data = nullptr;
+		size_t m_size = 0;
+#if defined(_WIN32)
+		void* mp_file = nullptr;	// HANDLEs, kept as void* so that windows.h stays out of the headers.
+		void* mp_mapping = nullptr;
+#else
+		int m_descriptor = -1;
+#endif
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+	public:
+		MappedFile() = default;
+		~MappedFile() { close(); }
+
+		bool open(const std::string& path); // Logs the reason and returns false on failure, leaving the file closed.
+		void close();
+
+		bool isOpen() const { return p_data != nullptr; }
+		const unsigned char* getData() const { return p_data; }
+		size_t getSize() const { return m_size; }
+	};
+}
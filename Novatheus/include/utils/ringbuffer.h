@@ -0,0 +1,31 @@
+#pragma once
+#include <array>
+#include <cstddef>
+
+namespace Utils {
+	// The last N values pushed, in fixed storage, so that pushing never allocates. Once full, each push replaces the oldest.
+	template <class T, size_t N>
+	class RingBuffer {
+	private:
+		std::array<T, N> m_values{};
+		size_t m_next = 0;	// Where the next push goes; the oldest value, once full.
+		size_t m_size = 0;
+	public:
+		void push(T value) {
+			m_values[m_next] = value;
+			m_next = (m_next + 1) % N;
+			if (m_size < N) { m_size++; }
+		}
+
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+		void clear() { m_next = 0; m_size = 0; }
+
+		// Summed oldest first, as the std::lists these replaced were, so averages come out the same to the bit.
+		T getAverage() const {
+			T sum = T();
+			for (size_t i = 0, first = (m_next + N - m_size) % N; i < m_size; i++) { sum += m_values[(first + i) % N]; }
+			return sum / (T)m_size;
+		}
+	};
+}
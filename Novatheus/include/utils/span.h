@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+
+namespace Utils {
+	// A view of count contiguous elements owned by someone else, as C++20's std::span, which this C++17 build lacks.
+	// Built from a pointer and a count, or from any container with data() and size(), such as a std::vector or std::array.
+	template <class T>
+	class Span {
+	private:
+		T* p_data = nullptr;
+		size_t m_size = 0;
+	public:
+		Span() = default;
+		Span(T* data, size_t size) : p_data(data), m_size(size) {}
+		template <class Container>
+		Span(Container& container) : p_data(container.data()), m_size(container.size()) {}
+
+		T* data() const { return p_data; }
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+
+		T& operator[](size_t index) const { return p_data[index]; }
+		T* begin() const { return p_data; }
+		T* end() const { return p_data + m_size; }
+	};
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "utils\utils.h"
+
+namespace Utils {
+	// A fixed set of worker threads for fork-join loops. The calling thread always takes part,
+	// so a pool of n threads owns n - 1 workers.
+	class ThreadPool {
+	private:
+		typedef void (*JobFunction)(void* context, uint begin, uint end);
+
+		std::vector<std::thread> m_workers;
+		uint m_threadCount;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+
+		// Current job. Only touched under m_mutex, or by workers between wake and done.
+		JobFunction mp_job = nullptr;
+		void* mp_jobContext = nullptr;
+		uint m_jobCount = 0u;
+		uint m_jobGeneration = 0u;
+		uint m_jobsOutstanding = 0u;
+		bool m_stopping = false;
+
+		void workerLoop(uint workerIndex);
+		void runJob(uint count, JobFunction job, void* context);
+
+		template <typename Func>
+		static void invoke(void* context, uint begin, uint end) { (*static_cast<Func*>(context))(begin, end); }
+	public:
+		ThreadPool(uint threadCount);
+		~ThreadPool();
+
+		uint getThreadCount() const { return m_threadCount; }
+
+		// Splits [0, count) into one contiguous chunk per thread, calls func(begin, end) for each and blocks until all are done.
+		// Chunk boundaries depend only on count and the thread count, so results are reproducible run to run.
+		template <typename Func>
+		void parallelFor(uint count, Func& func) { runJob(count, &ThreadPool::invoke<Func>, &func); }
+
+		static uint getChunkBegin(uint count, uint chunks, uint chunk) { return (uint)(((unsigned long long)count * chunk) / chunks); }
+	};
+}
@@ -33,6 +33,67 @@
 
 #define OUTPUT_COUNT 10u
 #define STANDARD_TRAINING_BATCH_COUNT 1260u
+// Minibatches the rolling training cost and accuracy are averaged over.
+#define TRAINING_BUFFER_BATCHES 100u
+// Whether training reshuffles its samples into new minibatches every epoch, and the seed each sampler mixes with its batch
+// offset. See MinibatchSampler.
+#define SHUFFLE_TRAINING_SAMPLES true
+#define SAMPLER_SEED 0x5EEDu
+// Steps of minibatches prepared ahead of each trainer when augmenting. See BatchPipeline.
+#define PIPELINE_PREFETCH_DEPTH 4u
+// Whether training samples are randomly distorted as they are dealt, the most they are shifted (pixels) and rotated
+// (degrees), and the largest elastic displacement (pixels) and the grid it is drawn on. See Augmenter.
+#define AUGMENT_TRAINING_SAMPLES false
+#define AUGMENT_MAX_SHIFT 2.0f
+#define AUGMENT_MAX_ROTATION 10.0f
+#define AUGMENT_ELASTIC_PIXELS 1.5f
+#define AUGMENT_ELASTIC_GRID 4u
+
+// Minimum multiply-adds in a network level before it is split across threads.
+#define PARALLEL_LEVEL_MIN_WORK 32768u
+// Samples per 64-byte cache line of a batched buffer row. Sample-parallel workers split minibatches on multiples of it, so
+// that neighbours rarely write the same line.
+#define SAMPLE_CHUNK_ALIGNMENT 16u
+// Neurons per tile of the block-sparse input product.
+#define INPUT_TILE_NEURONS 8u
+// Highest fraction of non-zero inputs in a minibatch for which the skip-zero input path is used.
+#define SPARSE_INPUT_MAX_DENSITY 0.5f
+// The same, for each fold of a FoldNetwork. Far lower: a fold's rows are CROSSVAL_COUNT times as far apart, so the scattered
+// adds miss cache where the input tiles stream, and MNIST's minibatches, at about 19%, are quicker through the tiles.
+#define FOLD_SPARSE_INPUT_MAX_DENSITY 0.05f
+// Whether network topologies permute their neurons for gather locality. See NetworkTopology::reorderNeurons.
+#define LOCALITY_REORDERING true
+// Whether cross-validation folds, and so population training, JIT-compile the weighted sums of their forward pass, the most
+// code one network may compile to, and whether the code is listed in /tmp/perf-<pid>.map on Linux. That file only ever
+// grows, so turn it on only to profile. Off on Windows, where the code can't run. See ForwardJit.
+#ifdef _WIN32
+#define JIT_FORWARD_PASS false
+#else
+#define JIT_FORWARD_PASS true
+#endif
+#define JIT_MAX_CODE_MB 64u
+#define JIT_PERF_MAP false
+// Minibatches run through a network to calibrate the value scales of its int8 copy. See QuantizedNetwork.
+#define QUANTIZATION_CALIBRATION_BATCHES 50u
+
+// Trained-weights files ('.weights', next to the genome's file). See Network::writeWeightsToFile.
+#define NETWORK_WEIGHTS_MAGIC 0x5354574Eu // "NWTS"
+#define NETWORK_WEIGHTS_VERSION 1u
+// Retooled dataset caches, in './cache/', next to './data/'. See Dataset::readCache.
+#define DATASET_CACHE_MAGIC 0x4344564Eu // "NVDC"
+#define DATASET_CACHE_VERSION 3u
+// Exported C++ forward passes: array elements per generated line, and samples in the embedded self-check. See CppExporter.
+#define EXPORT_VALUES_PER_LINE 8u
+#define EXPORT_CHECK_SAMPLES 16u
+// Inference server ('serve'): default port, longest a request waits for its minibatch to fill, requests the latency
+// percentiles are taken over, seconds between logged stats, bytes read from a client at a time, and most bytes of answers
+// a client may leave unread before it is dropped. See InferenceServer.
+#define SERVE_DEFAULT_PORT 5150u
+#define SERVE_BATCH_WINDOW_US 2000u
+#define SERVE_LATENCY_WINDOW 10000u
+#define SERVE_STATS_INTERVAL_S 10u
+#define SERVE_RECEIVE_BYTES 16384u
+#define SERVE_MAX_UNSENT_BYTES 1048576u
 
 // GEN_WIDTH must be a multiple of 16.
 #define GEN_WIDTH 16u
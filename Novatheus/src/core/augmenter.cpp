@@ -0,0 +1,78 @@
+#include "pch.h"
+#include "core/augmenter.h"
+
+namespace Core {
+	Augmenter::Augmenter(uint rows, uint columns, std::seed_seq& seed) :
+		m_rows(rows),
+		m_columns(columns),
+		m_rng(seed)
+	{
+		const uint nodes = (AUGMENT_ELASTIC_GRID + 1) * (AUGMENT_ELASTIC_GRID + 1);
+		m_elasticX.assign(nodes, 0.0f);
+		m_elasticY.assign(nodes, 0.0f);
+		m_sourceX.assign(m_columns, 0.0f);
+		m_sourceY.assign(m_columns, 0.0f);
+
+		// Which grid cell each column falls in never changes.
+		m_gridWeights.assign(m_columns, 0.0f);
+		m_gridCells.assign(m_columns, 0u);
+		for (uint x = 0; x < m_columns; x++) {
+			float g = (float)x * (float)AUGMENT_ELASTIC_GRID / (float)std::max(m_columns - 1, 1u);
+			m_gridCells[x] = std::min((uint)g, AUGMENT_ELASTIC_GRID - 1);
+			m_gridWeights[x] = g - (float)m_gridCells[x];
+		}
+	}
+
+	uint Augmenter::apply(const unsigned char* source, unsigned char* target)
+	{
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		const float angle = unit(m_rng) * (float)(AUGMENT_MAX_ROTATION * DEG2RAD);
+		const float shiftX = unit(m_rng) * AUGMENT_MAX_SHIFT;
+		const float shiftY = unit(m_rng) * AUGMENT_MAX_SHIFT;
+		for (auto& d : m_elasticX) { d = unit(m_rng) * AUGMENT_ELASTIC_PIXELS; }
+		for (auto& d : m_elasticY) { d = unit(m_rng) * AUGMENT_ELASTIC_PIXELS; }
+
+		const float cosine = std::cos(angle), sine = std::sin(angle);
+		const float centreX = (float)(m_columns - 1) * 0.5f, centreY = (float)(m_rows - 1) * 0.5f;
+		const uint stride = AUGMENT_ELASTIC_GRID + 1;
+
+		uint activeInputs = 0u;
+		for (uint y = 0; y < m_rows; y++) {
+			float g = (float)y * (float)AUGMENT_ELASTIC_GRID / (float)std::max(m_rows - 1, 1u);
+			const uint cellY = std::min((uint)g, AUGMENT_ELASTIC_GRID - 1);
+			const float wy = g - (float)cellY;
+			const float* topX = m_elasticX.data() + cellY * stride;
+			const float* topY = m_elasticY.data() + cellY * stride;
+			const float* bottomX = topX + stride;
+			const float* bottomY = topY + stride;
+			const float v = (float)y - centreY - shiftY;
+
+			// Where each pixel of the row is sampled from.
+			for (uint x = 0; x < m_columns; x++) {
+				const uint cell = m_gridCells[x];
+				const float wx = m_gridWeights[x];
+				const float elasticX = (topX[cell] * (1.0f - wx) + topX[cell + 1] * wx) * (1.0f - wy) + (bottomX[cell] * (1.0f - wx) + bottomX[cell + 1] * wx) * wy;
+				const float elasticY = (topY[cell] * (1.0f - wx) + topY[cell + 1] * wx) * (1.0f - wy) + (bottomY[cell] * (1.0f - wx) + bottomY[cell + 1] * wx) * wy;
+				const float u = (float)x - centreX - shiftX;
+				m_sourceX[x] = cosine * u + sine * v + centreX + elasticX;
+				m_sourceY[x] = cosine * v - sine * u + centreY + elasticY;
+			}
+
+			// Bilinear, with blank outside the image. Truncated, so that faint edges stay blank for the skip-zero path.
+			unsigned char* row = target + (size_t)y * m_columns;
+			for (uint x = 0; x < m_columns; x++) {
+				const float fx = std::floor(m_sourceX[x]), fy = std::floor(m_sourceY[x]);
+				const float ax = m_sourceX[x] - fx, ay = m_sourceY[x] - fy;
+				const int x0 = (int)fx, y0 = (int)fy;
+				auto at = [&](int px, int py) {
+					return (px < 0 || py < 0 || px >= (int)m_columns || py >= (int)m_rows) ? 0.0f : (float)source[(size_t)py * m_columns + px];
+				};
+
+				float value = (at(x0, y0) * (1.0f - ax) + at(x0 + 1, y0) * ax) * (1.0f - ay) + (at(x0, y0 + 1) * (1.0f - ax) + at(x0 + 1, y0 + 1) * ax) * ay;
+				row[x] = (unsigned char)std::min(value, 255.0f);
+				if (row[x] != 0) { activeInputs++; }
+			}
+		}
+		return activeInputs;
+	}
+}
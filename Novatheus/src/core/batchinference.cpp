@@ -0,0 +1,165 @@
+#include "pch.h"
+#include "core/batchinference.h"
+#include "core/genome.h"
+#include "core/network.h"
+
+namespace Core {
+	namespace {
+		void writeBigEndian(std::ofstream& file, uint value)
+		{
+			const char bytes[4] = { (char)(value >> 24), (char)(value >> 16), (char)(value >> 8), (char)value };
+			file.write(bytes, 4);
+		}
+	}
+
+	BatchInference::BatchInference(Utils::Forwarder* forwarder, const IdxFile& images, const IdxFile* labels) :
+		HasForwarder(forwarder),
+		r_images(images),
+		p_labels(labels)
+	{}
+
+	BatchInference::~BatchInference() {}
+
+	bool BatchInference::addGenome(uint populationID, uint generation)
+	{
+		const std::string path = "./genomes/" + std::to_string(populationID) + "/" + std::to_string(generation);
+		std::ifstream genomeFile(path + ".genome", std::ios::in | std::ios::binary);
+		if (!genomeFile.is_open()) {
+			WARN("id{0}: Could not open genome file '{1}.genome'. Skipping it.", getID(), path);
+			return false;
+		}
+
+		auto entry = std::make_unique<Entry>();
+		entry->m_populationID = populationID;
+		entry->m_generation = generation;
+		entry->mp_genome = std::make_unique<Genome>(getForwarder(), genomeFile, false);
+		entry->mp_network = std::make_unique<Network>(entry->mp_genome.get(), new FastSigmoid());
+
+		if ((size_t)entry->mp_network->getInputCount() != r_images.getItemSize()) {
+			WARN("id{0}: Genome {1}/{2} takes {3} inputs, but the images are {4} bytes. Skipping it.", getID(), populationID, generation, entry->mp_network->getInputCount(), r_images.getItemSize());
+			return false;
+		}
+
+		std::ifstream weightsFile(path + ".weights", std::ios::in | std::ios::binary);
+		if (!weightsFile.is_open()) { WARN("id{0}: No weights saved for genome {1}/{2}. Scoring it untrained; save its weights with 'sw' first.", getID(), populationID, generation); }
+		else if (!entry->mp_network->readWeightsFromFile(weightsFile)) { WARN("id{0}: Weights for genome {1}/{2} could not be read. Scoring it untrained.", getID(), populationID, generation); }
+
+		m_entries.push_back(std::move(entry));
+		return true;
+	}
+
+	void BatchInference::run(Format format)
+	{
+		if (m_entries.empty()) {
+			WARN("id{0}: No genomes to score.", getID());
+			return;
+		}
+
+		const uint imageCount = r_images.getItemCount();
+		const uint threads = std::max(std::thread::hardware_concurrency(), 1u);
+		const uint workers = std::min((uint)m_entries.size(), threads);
+		for (auto& entry : m_entries) { entry->mp_network->setThreadCount(std::max(threads / workers, 1u)); }
+
+		INFO("id{0}: Scoring {1} genomes on {2} images, {3} at a time, with {4} threads each...", getID(), m_entries.size(), imageCount, workers, std::max(threads / workers, 1u));
+
+		auto start = std::chrono::steady_clock::now();
+		std::atomic<uint> next(0u);
+		std::vector<std::future<void>> ongoing;
+		for (uint w = 0; w < workers; w++) {
+			ongoing.emplace_back(std::async(std::launch::async, [this, &next, format]() {
+				for (uint e = next++; e < m_entries.size(); e = next++) { score(*m_entries[e], format); }
+			}));
+		}
+		for (auto& f : ongoing) { f.get(); }
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		INFO("id{0}: Scored {1} genomes in {2} s: {3} images/s in all.", getID(), m_entries.size(), seconds, (double)imageCount * (double)m_entries.size() / seconds);
+
+		if (p_labels != nullptr && m_entries.size() > 1) {
+			std::vector<const Entry*> ranking;
+			for (auto& entry : m_entries) { ranking.push_back(entry.get()); }
+			std::stable_sort(ranking.begin(), ranking.end(), [](const Entry* a, const Entry* b) { return a->m_correct > b->m_correct; });
+
+			INFO("id{0}: Ranking by accuracy:", getID());
+			for (uint r = 0; r < ranking.size(); r++) {
+				INFO("  {0}. Genome {1}/{2}: {3}%", r + 1, ranking[r]->m_populationID, ranking[r]->m_generation, (100.0f * (float)ranking[r]->m_correct) / (float)imageCount);
+			}
+		}
+	}
+
+	void BatchInference::score(Entry& entry, Format format)
+	{
+		Network& network = *entry.mp_network;
+		const uint imageCount = r_images.getItemCount();
+		const uint inputCount = network.getInputCount(), outputCount = network.getOutputCount();
+
+		std::vector<float> inputs((size_t)MINIBATCH_COUNT * inputCount);
+		std::vector<float> outputs((size_t)MINIBATCH_COUNT * outputCount);
+		entry.m_predictions.assign(imageCount, 0u);
+		if (format == Format::Csv) { entry.m_outputs.assign((size_t)imageCount * outputCount, 0.0f); }
+		entry.m_correct = 0u;
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint first = 0; first < imageCount; first += MINIBATCH_COUNT) {
+			const uint count = std::min(MINIBATCH_COUNT, imageCount - first);
+
+			// Consecutive images are contiguous in the file, so the whole minibatch is one run of bytes.
+			const unsigned char* pixels = r_images.getItem(first);
+			for (size_t p = 0, end = (size_t)count * inputCount; p < end; p++) { inputs[p] = Dataset::pixelToInput(pixels[p]); }
+
+			network.runInputsBatch(inputs.data(), count, outputs.data());
+
+			for (uint s = 0; s < count; s++) {
+				const float* sampleOutputs = outputs.data() + (size_t)s * outputCount;
+				const unsigned char prediction = (unsigned char)(std::max_element(sampleOutputs, sampleOutputs + outputCount) - sampleOutputs);
+				entry.m_predictions[first + s] = prediction;
+				if (p_labels != nullptr && *p_labels->getItem(first + s) == prediction) { entry.m_correct++; }
+			}
+			if (format == Format::Csv) { std::copy(outputs.begin(), outputs.begin() + (size_t)count * outputCount, entry.m_outputs.begin() + (size_t)first * outputCount); }
+		}
+		entry.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		bool written = write(entry, format);
+		if (p_labels != nullptr) {
+			INFO("id{0}: Genome {1}/{2}: {3} images in {4} s, {5} images/s. Accuracy: {6}%.{7}",
+				getID(), entry.m_populationID, entry.m_generation, imageCount, entry.m_seconds, (double)imageCount / entry.m_seconds,
+				(100.0f * (float)entry.m_correct) / (float)imageCount, written ? "" : " Predictions could not be written.");
+		}
+		else {
+			INFO("id{0}: Genome {1}/{2}: {3} images in {4} s, {5} images/s.{6}",
+				getID(), entry.m_populationID, entry.m_generation, imageCount, entry.m_seconds, (double)imageCount / entry.m_seconds,
+				written ? "" : " Predictions could not be written.");
+		}
+
+		// Only the predictions on file are wanted from here.
+		entry.m_outputs = std::vector<float>();
+	}
+
+	bool BatchInference::write(const Entry& entry, Format format) const
+	{
+		const std::string path = "./predictions/" + std::to_string(entry.m_populationID) + "_" + std::to_string(entry.m_generation) + ((format == Format::Csv) ? ".csv" : ".idx1-ubyte");
+		std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!file.is_open()) { return false; }
+
+		const uint imageCount = (uint)entry.m_predictions.size();
+		if (format == Format::Idx) {
+			writeBigEndian(file, 2049u); // Unsigned bytes, one dimension: as the label files.
+			writeBigEndian(file, imageCount);
+			file.write(reinterpret_cast<const char*>(entry.m_predictions.data()), imageCount);
+			return file.good();
+		}
+
+		const uint outputCount = entry.mp_network->getOutputCount();
+		file << "sample,prediction" << ((p_labels != nullptr) ? ",label" : "");
+		for (uint o = 0; o < outputCount; o++) { file << ",output" << o; }
+		file << "\n";
+
+		for (uint s = 0; s < imageCount; s++) {
+			file << s << "," << (uint)entry.m_predictions[s];
+			if (p_labels != nullptr) { file << "," << (uint)*p_labels->getItem(s); }
+			for (uint o = 0; o < outputCount; o++) { file << "," << entry.m_outputs[(size_t)s * outputCount + o]; }
+			file << "\n";
+		}
+		return file.good();
+	}
+}
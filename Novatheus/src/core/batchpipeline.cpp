@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "core/batchpipeline.h"
+
+namespace Core {
+	BatchPipeline::Lane::Lane(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset, uint depth) :
+		m_sampler(dataset, testSections, batchOffset),
+		m_slots(depth)
+	{
+		if (AUGMENT_TRAINING_SAMPLES) {
+			// Its own stream, apart from the sampler's, so that turning augmentation on leaves the minibatches as they were.
+			std::seed_seq seed { SAMPLER_SEED, batchOffset, 1u };
+			mp_augmenter = std::make_unique<Augmenter>(dataset.getImageRows(), dataset.getImageColumns(), seed);
+			for (auto& slot : m_slots) { slot.m_pixels.assign((size_t)MINIBATCH_COUNT * dataset.getSampleSize(), 0u); }
+		}
+	}
+
+	BatchPipeline::BatchPipeline(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset, uint batchCount) :
+		m_depth(AUGMENT_TRAINING_SAMPLES ? std::max(PIPELINE_PREFETCH_DEPTH, 1u) : 1u),
+		m_batchCount(batchCount)
+	{
+		m_lanes.reserve(1);
+		m_lanes.emplace_back(dataset, testSections, batchOffset, m_depth);
+		start();
+	}
+
+	BatchPipeline::BatchPipeline(const Dataset& dataset, const std::array<std::array<bool, CROSSVAL_COUNT>, CROSSVAL_COUNT>& testSections, const std::array<uint, CROSSVAL_COUNT>& batchOffsets, uint batchCount) :
+		m_depth(AUGMENT_TRAINING_SAMPLES ? std::max(PIPELINE_PREFETCH_DEPTH, 1u) : 1u),
+		m_batchCount(batchCount)
+	{
+		m_lanes.reserve(CROSSVAL_COUNT);
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) { m_lanes.emplace_back(dataset, testSections[f], batchOffsets[f], m_depth); }
+		start();
+	}
+
+	void BatchPipeline::start()
+	{
+		if (!AUGMENT_TRAINING_SAMPLES) { return; }
+		for (auto& lane : m_lanes) {
+			if (lane.m_sampler.getEpochSampleCount() == 0u) { return; }
+		}
+		m_producer = std::thread(&BatchPipeline::produce, this);
+	}
+
+	BatchPipeline::~BatchPipeline()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_free.notify_one();
+
+		if (m_producer.joinable()) { m_producer.join(); }
+	}
+
+	void BatchPipeline::produce()
+	{
+		for (uint b = 0; b < m_batchCount; b++) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_free.wait(lock, [&]() { return m_stopping || b - m_consumed < m_depth; });
+				if (m_stopping) { return; }
+			}
+
+			// The step's slots are this thread's alone until it is counted as produced.
+			prepareStep(b);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_produced = b + 1;
+			}
+			m_ready.notify_one();
+		}
+	}
+
+	void BatchPipeline::prepareStep(uint step)
+	{
+		for (auto& lane : m_lanes) { prepare(lane, lane.m_slots[step % m_depth]); }
+	}
+
+	void BatchPipeline::prepare(Lane& lane, Slot& slot)
+	{
+		slot.m_epoch = lane.m_sampler.getEpoch();
+		lane.m_sampler.next(slot.m_batch);
+		slot.m_endsEpoch = (lane.m_sampler.getEpoch() != slot.m_epoch);
+
+		if (lane.mp_augmenter == nullptr) { return; }
+
+		const uint sampleSize = (uint)(slot.m_pixels.size() / MINIBATCH_COUNT);
+		slot.m_batch.m_activeInputCount = 0u;
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			Sample& sample = slot.m_batch.m_samples[s];
+			unsigned char* pixels = slot.m_pixels.data() + (size_t)s * sampleSize;
+			sample.m_activeInputCount = lane.mp_augmenter->apply(sample.p_pixels, pixels);
+			sample.p_pixels = pixels;
+			slot.m_batch.m_activeInputCount += sample.m_activeInputCount;
+		}
+	}
+
+	BatchPipeline::Slot& BatchPipeline::acquire(uint lane)
+	{
+		if (!m_producer.joinable()) {
+			// Dealt inline, every lane at the first acquire of the step.
+			if (m_produced == m_consumed) {
+				prepareStep(m_produced);
+				m_produced++;
+			}
+			return m_lanes[lane].m_slots[m_consumed % m_depth];
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_produced == m_consumed) {
+			auto start = std::chrono::steady_clock::now();
+			m_ready.wait(lock, [&]() { return m_produced != m_consumed; });
+			m_waited += std::chrono::steady_clock::now() - start;
+		}
+		return m_lanes[lane].m_slots[m_consumed % m_depth];
+	}
+
+	void BatchPipeline::release()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_consumed++;
+		}
+		m_free.notify_one();
+	}
+}
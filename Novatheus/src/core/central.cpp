@@ -1,6 +1,11 @@
 #include "pch.h"
 #include "core\central.h"
 #include "core/network.h"
+#include "core/kernels.h"
+#include "core/cppexporter.h"
+#include "core/inferenceserver.h"
+#include "core/batchinference.h"
+#include "core/quantizednetwork.h"
 
 namespace Core {
 	void CentralController::generateRandomNetwork(bool detailedOutput)
@@ -275,10 +280,11 @@ namespace Core {
 
 			for (uint i = 0; i < GEN_WIDTH; i++) { m_popRunStates[i] = RunState::Awaiting; }
 
-			const uint simulTest = 2u; // How many pops to test simultaneously. Note that each pop will run 10 threads.
+			const uint simulTest = 2u; // How many pops to test simultaneously. Each pop trains its folds in lockstep, sharing the cores out evenly.
+			const uint foldThreads = std::max(std::thread::hardware_concurrency() / simulTest, 1u);
 			std::vector<std::future<bool>> ongoingTests; // Returns true for success.
 			for (uint i = 0; i < simulTest; i++) {
-				ongoingTests.emplace_back(std::async(std::launch::async, [this]() {
+				ongoingTests.emplace_back(std::async(std::launch::async, [this, foldThreads]() {
 					bool keepRunning = true;
 					while (keepRunning) {
 						uint candidate = 0u;
@@ -305,7 +311,7 @@ namespace Core {
 						// Test the candidate.
 						if (keepRunning) {
 							INFO("Starting crossvalidated training and testing for genome id{0}...", mvp_generation[candidate]->getID());
-							trainTestAndCrossval<FastSigmoid>(mvp_generation[candidate], STANDARD_TRAINING_BATCH_COUNT);
+							trainTestAndCrossval<FastSigmoid>(mvp_generation[candidate], STANDARD_TRAINING_BATCH_COUNT, foldThreads);
 							INFO("Completed crossvalidated training and testing for genome id{0}.", mvp_generation[candidate]->getID());
 							{
 								std::lock_guard<std::mutex> lock(m_popRunStatesMutex);
@@ -608,7 +614,7 @@ namespace Core {
 			if (params.size() > 0) { batchCount = std::stoi(params[0]); }
 
 			INFO("Starting cross-validated training of genome for {0} batches.", batchCount);
-			trainTestAndCrossval<FastSigmoid>(mp_genome, batchCount);
+			trainTestAndCrossval<FastSigmoid>(mp_genome, batchCount, std::thread::hardware_concurrency());
 			INFO("Cross-validated training complete.");
 
 			return;
@@ -646,6 +652,132 @@ namespace Core {
 			else { WARN("Operation failed: Output file was not detected as open, suggesting error."); }
 			return;
 		}
+		else if (command == "save_weights" ||
+			command == "sw") {
+			if (mp_network == nullptr) {
+				WARN("No network available to save! Use 'gen_random_network' ('grn') or 'load_network' ('ln'), followed by 'train_network' ('tn').");
+				return;
+			}
+
+			std::string filepath = "/genomes/" + std::to_string(mp_genome->getPopulationID());
+			std::string t = std::filesystem::current_path().string() + filepath;
+			if (!std::filesystem::exists(std::filesystem::path(t))) {
+				INFO("Folder does not exist. Generating: '{0}'", t);
+				std::filesystem::create_directories(std::filesystem::path(t));
+			}
+
+			t = "." + filepath + "/" + std::to_string(mp_genome->getGeneration()) + ".weights";
+			INFO("Saving trained weights to file: '{0}'", t);
+			std::ofstream outputFile(t, std::ios::out | std::ios::trunc | std::ios::binary);
+			if (outputFile.is_open()) {
+				mp_network->writeWeightsToFile(outputFile);
+				INFO("Successfully saved weights of network id{0}.", mp_network->getID());
+			}
+			else { WARN("Operation failed: Output file was not detected as open, suggesting error."); }
+			return;
+		}
+		else if (command == "load_weights" ||
+			command == "lw") {
+			if (mp_network == nullptr) {
+				WARN("No network available to load weights into! Use 'load_network' ('ln') first.");
+				return;
+			}
+
+			std::string filepath = "./genomes/" + std::to_string(mp_genome->getPopulationID()) + "/" + std::to_string(mp_genome->getGeneration()) + ".weights";
+			if (params.size() > 0) { filepath = "./genomes/" + params[0]; }
+
+			INFO("Loading trained weights from file: '{0}'", filepath);
+			std::ifstream inputFile(filepath, std::ios::in | std::ios::binary);
+			if (!inputFile.is_open()) { WARN("Operation failed: Input file was not detected as open, suggesting error."); }
+			else if (mp_network->readWeightsFromFile(inputFile)) { INFO("Loaded trained weights into network id{0}.", mp_network->getID()); }
+			return;
+		}
+		else if (command == "export_cpp" ||
+			command == "ecpp") {
+			if (mp_network == nullptr) {
+				WARN("No network available to export! Use 'load_network' ('ln'), then 'train_network' ('tn') or 'load_weights' ('lw').");
+				return;
+			}
+
+			std::string name = "novatheus_" + std::to_string(mp_genome->getPopulationID()) + "_" + std::to_string(mp_genome->getGeneration());
+			std::string t = std::filesystem::current_path().string() + "/exports";
+			if (!std::filesystem::exists(std::filesystem::path(t))) {
+				INFO("Folder does not exist. Generating: '{0}'", t);
+				std::filesystem::create_directories(std::filesystem::path(t));
+			}
+
+			t = "./exports/" + name + ".cpp";
+			INFO("Exporting network id{0} to C++ source: '{1}'", mp_network->getID(), t);
+			std::ofstream outputFile(t, std::ios::out | std::ios::trunc);
+			if (!outputFile.is_open()) { WARN("Operation failed: Output file was not detected as open, suggesting error."); }
+			else if (CppExporter(*mp_network).writeToFile(outputFile, mp_dataset, name)) { INFO("Export complete. Compile with optimisations on, eg. 'g++ -O2 -DNOVATHEUS_CHECK {0}'.", t); }
+			return;
+		}
+		else if (command == "infer" ||
+			command == "inf") {
+			if (params.size() < 4) {
+				WARN("Not enough parameters. Use eg. 'infer MNIST/train-images.idx3-ubyte MNIST/train-labels.idx1-ubyte csv 8828 0 3', or '-' for no labels.");
+				return;
+			}
+
+			BatchInference::Format format;
+			if (params[2] == "csv") { format = BatchInference::Format::Csv; }
+			else if (params[2] == "idx") { format = BatchInference::Format::Idx; }
+			else {
+				WARN("Unrecognised output format '{0}'. Use 'csv' or 'idx'.", params[2]);
+				return;
+			}
+
+			IdxFile images, labels;
+			if (!images.open("./data/" + params[0], 2051)) { return; }
+			const bool hasLabels = (params[1] != "-");
+			if (hasLabels) {
+				if (!labels.open("./data/" + params[1], 2049)) { return; }
+				if (labels.getItemCount() != images.getItemCount()) {
+					WARN("Image/Label count mismatch! {0} images, {1} labels.", images.getItemCount(), labels.getItemCount());
+					return;
+				}
+			}
+
+			// Every generation saved in the population's folder, unless some are named.
+			const uint populationID = std::stoul(params[3]);
+			std::vector<uint> generations;
+			for (size_t p = 4; p < params.size(); p++) { generations.push_back(std::stoul(params[p])); }
+			if (generations.empty()) {
+				std::string folder = "./genomes/" + params[3];
+				if (std::filesystem::exists(std::filesystem::path(folder))) {
+					for (auto& file : std::filesystem::directory_iterator(folder)) {
+						std::string stem = file.path().stem().string();
+						if (file.path().extension() == ".genome" && !stem.empty() && std::all_of(stem.begin(), stem.end(), ::isdigit)) { generations.push_back(std::stoul(stem)); }
+					}
+				}
+				std::sort(generations.begin(), generations.end());
+			}
+
+			std::string t = std::filesystem::current_path().string() + "/predictions";
+			if (!std::filesystem::exists(std::filesystem::path(t))) {
+				INFO("Folder does not exist. Generating: '{0}'", t);
+				std::filesystem::create_directories(std::filesystem::path(t));
+			}
+
+			BatchInference inference(mp_forwarder, images, hasLabels ? &labels : nullptr);
+			for (uint generation : generations) { inference.addGenome(populationID, generation); }
+			inference.run(format);
+			return;
+		}
+		else if (command == "serve" ||
+			command == "sv") {
+			if (mp_network == nullptr) {
+				WARN("No network available to serve! Use 'load_network' ('ln'), then 'train_network' ('tn') or 'load_weights' ('lw').");
+				return;
+			}
+
+			unsigned short port = (unsigned short)SERVE_DEFAULT_PORT;
+			if (params.size() > 0) { port = (unsigned short)std::stoul(params[0]); }
+
+			InferenceServer(*mp_network, port).run();
+			return;
+		}
 		else if (command == "load_network" ||
 			command == "ln" ||
 			command == "load_genome" ||
@@ -728,6 +860,113 @@ namespace Core {
 			mp_network->setLearningRate(std::stof(params[0]), std::stof(params[1]));
 			INFO("Set network learning rate to (2^{0})->(2^{1}).", params[0], params[1]);
 		}
+		else if (command == "set_network_threads" ||
+			command == "snt") {
+			if (mp_network == nullptr) {
+				WARN("No network available! Use 'gen_random_network' ('grn') or 'load_network' ('ln').");
+				return;
+			}
+
+			uint threadCount = std::thread::hardware_concurrency();
+			if (params.size() > 0) { threadCount = std::stoi(params[0]); }
+
+			bool splitSamples = false;
+			if (params.size() > 1) {
+				if (params[1] == "samples" || params[1] == "s") { splitSamples = true; }
+				else if (params[1] != "levels" && params[1] != "l") {
+					WARN("Unrecognised split mode '{0}'. Use 'levels' ('l') or 'samples' ('s'), eg. 'snt 8 samples'.", params[1]);
+					return;
+				}
+			}
+
+			mp_network->setThreadCount(threadCount, splitSamples);
+			if (mp_network->getSplitSamples()) { INFO("Network will now split each minibatch of {0} samples across {1} threads.", MINIBATCH_COUNT, mp_network->getThreadCount()); }
+			else { INFO("Network will now evaluate each of its {0} levels across {1} threads.", mp_network->getLevelCount(), mp_network->getThreadCount()); }
+			return;
+		}
+		else if (command == "quantize_network" ||
+			command == "qn") {
+			if (mp_network == nullptr) {
+				WARN("No network available to quantize! Use 'gen_random_network' ('grn') or 'load_network' ('ln').");
+				return;
+			}
+			if (!mp_dataset->getAlreadyInitialised()) {
+				WARN("No dataset available for calibration purposes! Use 'load_dataset' ('ld') or 'load_default_dataset' ('ldd').");
+				return;
+			}
+
+			uint calibrationBatches = QUANTIZATION_CALIBRATION_BATCHES;
+			if (params.size() > 0) { calibrationBatches = std::stoi(params[0]); }
+
+			// Calibrate on the sections 'train_network' trains on, and compare on the ones it tests on.
+			std::array<bool, CROSSVAL_COUNT> testSections { true, true, true };
+			std::array<bool, CROSSVAL_COUNT> calibrationSections;
+			for (uint s = 0; s < CROSSVAL_COUNT; s++) { calibrationSections[s] = !testSections[s]; }
+
+			QuantizedNetwork quantized(*mp_network, mp_dataset, calibrationSections, calibrationBatches);
+			quantized.reportDrift(*mp_network, mp_dataset, testSections);
+			return;
+		}
+		else if (command == "set_mixed_precision" ||
+			command == "smp") {
+			if (mp_network == nullptr) {
+				WARN("No network available! Use 'gen_random_network' ('grn') or 'load_network' ('ln').");
+				return;
+			}
+
+			bool mixedPrecision = true;
+			if (params.size() > 0) {
+				if (params[0] == "off" || params[0] == "0") { mixedPrecision = false; }
+				else if (params[0] != "on" && params[0] != "1") {
+					WARN("Unrecognised setting '{0}'. Use 'on' or 'off', eg. 'smp off'.", params[0]);
+					return;
+				}
+			}
+
+			mp_network->setMixedPrecision(mixedPrecision);
+			if (mixedPrecision) { INFO("Network will now run its passes on bf16 weights, keeping fp32 master weights and gradients."); }
+			else { INFO("Network will now run its passes on fp32 weights."); }
+			return;
+		}
+		else if (command == "set_jit" ||
+			command == "sj") {
+			if (mp_network == nullptr) {
+				WARN("No network available! Use 'gen_random_network' ('grn') or 'load_network' ('ln').");
+				return;
+			}
+
+			bool useJit = true;
+			if (params.size() > 0) {
+				if (params[0] == "off" || params[0] == "0") { useJit = false; }
+				else if (params[0] != "on" && params[0] != "1") {
+					WARN("Unrecognised setting '{0}'. Use 'on' or 'off', eg. 'sj off'.", params[0]);
+					return;
+				}
+			}
+
+			mp_network->setUseJit(useJit);
+			if (useJit) { INFO("Network will now run its batched weighted sums as JIT-compiled code, where this machine can."); }
+			else { INFO("Network will now run its batched weighted sums on the kernels."); }
+			return;
+		}
+		else if (command == "set_kernels" ||
+			command == "sk") {
+			Kernels::Level level = Kernels::getBestSupported();
+			if (params.size() > 0 && params[0] != "auto") {
+				if (params[0] == "scalar") { level = Kernels::Level::Scalar; }
+				else if (params[0] == "sse") { level = Kernels::Level::SSE; }
+				else if (params[0] == "avx2") { level = Kernels::Level::AVX2; }
+				else if (params[0] == "avx512") { level = Kernels::Level::AVX512; }
+				else {
+					WARN("Unrecognised kernel set '{0}'. Use one of 'auto', 'scalar', 'sse', 'avx2' or 'avx512'.", params[0]);
+					return;
+				}
+			}
+
+			if (Kernels::select(level)) { INFO("Using {0} network kernels.", Kernels::getName(level)); }
+			else { WARN("This machine cannot run {0} kernels. Still using {1}.", Kernels::getName(level), Kernels::getName(Kernels::getSelected())); }
+			return;
+		}
 		else if (command == "about") {
 			INFO("Project Novatheus was built by Sniggyfigbat as part of a Master's-level coursework.");
 			INFO("Github: https://github.com/sniggyfigbat/Novatheus");
@@ -741,15 +980,25 @@ namespace Core {
 			INFO("  - 'load_default_dataset' ('ldd') :\t\tLoads the MNIST dataset.");
 			INFO("  - 'gen_random_network' ('grn') :\t\tGenerates a single genome, creates a network from it, and stores both in their respective slots.");
 			INFO("  - 'train_network' ('tn') :\t\t\tuint batches = 420u, uint batchStartingOffset = 0u :\tTrains the network stored in the single slot for the given number of batches, starting at the offset given.");
-			INFO("  - 'crossval_train_network' ('ctn') :\tuint batches = 420u :\tGenerates 10 networks from the solo-slot genome, then trains each from a cross-validates selection of batches, using multiple cores.");
+			INFO("  - 'crossval_train_network' ('ctn') :\tuint batches = 420u :\tTrains 10 networks from the solo-slot genome, each on a cross-validated selection of batches, in lockstep across all cores.");
 			INFO("  - 'save_network' ('sn') :\t\t\tSaves the network stored in the single slot to file, in the appropriate subfolder of 'Novatheus/genomes/'.");
 			INFO("  - 'load_network' ('ln') :\t\t\tuint populationID, uint generation=0 :\tLoads to the single slot the network found in the corresponding file, 'Novatheus/genomes/$populationID$/$generation$.genome'.");
+			INFO("  - 'save_weights' ('sw') :\t\t\tSaves the solo-slot network's trained weights next to its genome, as 'Novatheus/genomes/$populationID$/$generation$.weights'.");
+			INFO("  - 'load_weights' ('lw') :\t\t\tstring path = that of 'sw' :\tLoads trained weights saved by 'sw' into the solo-slot network. Path relative to 'Novatheus/genomes/'.");
+			INFO("  - 'export_cpp' ('ecpp') :\t\t\tWrites the solo-slot network's forward pass out as standalone C++, with a self-check, to 'Novatheus/exports/'.");
+			INFO("  - 'infer' ('inf') :\t\t\t\tstring imagePath, string labelPath, string format, uint populationID, uint generations... = all :\tScores saved genomes, with their saved weights, on every image of an IDX file, concurrently. Writes each one's predictions to 'Novatheus/predictions/' as 'csv' or 'idx', and ranks them if labels are given ('-' for none). Paths relative to 'Novatheus/data/'.");
+			INFO("  - 'serve' ('sv') :\t\t\t\tuint port = 5150u :\tServes the solo-slot network to local clients over TCP, batching their requests into minibatches, until one sends a stop message. See InferenceServer for the protocol.");
 			INFO("  - 'gen_random_population' ('grp') :\tGenerates a population of genomes, and stores them in the population slot.");
 			INFO("  - 'train_population' ('tp') :\t\tuint maxGenerations=infinite :\tTrains the population of genomes for the given number of generations, using over 20 threads. Takes many hours.");
 			INFO("  - 'save_population' ('sp') :\t\tSaves the population to file, in the appropriate subfolder of 'Novatheus/genomes/'.");
 			INFO("  - 'load_population' ('lp') :\t\tuint populationID, uint generation :\tLoads to the population slot the genomes found in the corresponding file, 'Novatheus/genomes/$populationID$/$generation$.population'.");
 			INFO("  - 'step_population' ('step_p') :\t\tRuns the generation-incrementation code on the population slot.");
 			INFO("  - 'set_network_lr' ('snlr') :\t\tfloat startExponent, float deltaExponentSets.\tSets the learning-rate-calculation variables in the solo-slot network.");
+			INFO("  - 'set_network_threads' ('snt') :\t\tuint threads = all cores, string split = levels :\tSets how many threads the solo-slot network uses, splitting either each level of neurons ('levels') or each minibatch's samples ('samples') across them.");
+			INFO("  - 'quantize_network' ('qn') :\t\tuint calibrationBatches = 50u :\tBuilds an int8 copy of the solo-slot network, calibrated on its training sections, and reports its drift from it on the testing sections.");
+			INFO("  - 'set_mixed_precision' ('smp') :\tstring mode = on :\tRuns the solo-slot network's passes on bf16 copies of its weights ('on'), or on the fp32 weights ('off'). Testing reports both.");
+			INFO("  - 'set_jit' ('sj') :\t\t\tstring mode = on :\tRuns the solo-slot network's batched weighted sums as JIT-compiled x86-64 ('on'), or on the kernels ('off'). Cross-validation folds always use it, where this machine can.");
+			INFO("  - 'set_kernels' ('sk') :\t\t\tstring set = auto :\tSelects the network kernels: 'scalar' (reference), 'sse', 'avx2' or 'avx512'. 'auto' picks the best this machine supports.");
 			INFO("");
 			CRITICAL("IMPORTANT! When training, populations are saved AFTER testing but BEFORE the next generation is generated. As such, always run 'step_p' after loading a population, before further training.");
 			INFO("");
@@ -763,28 +1012,24 @@ namespace Core {
 	}
 
 	template <class SquishifierType>
-	Core::Metrics CentralController::trainTestAndCrossval(Genome* genome, uint batches)
+	Core::Metrics CentralController::trainTestAndCrossval(Genome* genome, uint batches, uint threadCount)
 	{
-		std::vector<Network *> networks;
-		networks.reserve(CROSSVAL_COUNT);
-		for (uint n = 0; n < CROSSVAL_COUNT; n++) {
-			networks.push_back(new Network(genome, new SquishifierType()));
-		}
+		FoldNetwork folds(genome, std::make_shared<const NetworkTopology>(genome), new SquishifierType());
+		folds.setThreadCount(threadCount);
 		
 		std::vector<uint> testSections;
 		uint testSectionCount = (uint)(((float)CROSSVAL_COUNT) * 0.3f);
 		testSections.reserve(testSectionCount);
 		for (uint t = 0; t < testSectionCount; t++) { testSections.push_back(t); }
 
-		std::vector<std::future<Metrics>> results;
-		results.reserve(CROSSVAL_COUNT);
+		std::array<FoldNetwork::SectionMask, CROSSVAL_COUNT> sections{};
+		std::array<uint, CROSSVAL_COUNT> offsets{};
 
 		uint offset = 0u;
 		for (uint t = 0; t < CROSSVAL_COUNT; t++) {
-			std::array<bool, CROSSVAL_COUNT> sections{};
-			for (auto test : testSections) { sections[test] = true; }
+			for (auto test : testSections) { sections[t][test] = true; }
 
-			results.emplace_back(std::async(std::launch::async, &Network::trainFromDataset, networks[t], mp_dataset, sections, batches, offset, false));
+			offsets[t] = offset;
 			offset += (uint)mp_dataset->m_data[t].m_batches.size() * MINIBATCH_COUNT;
 
 			for (auto& test : testSections) {
@@ -792,8 +1037,10 @@ namespace Core {
 			}
 		}
 
-		Metrics total = results[0].get();
-		for (uint r = 1; r < CROSSVAL_COUNT; r++) { total = total + results[r].get(); }
+		auto results = folds.trainFromDataset(mp_dataset, sections, offsets, batches);
+
+		Metrics total = results[0];
+		for (uint r = 1; r < CROSSVAL_COUNT; r++) { total = total + results[r]; }
 		total = total / CROSSVAL_COUNT;
 
 		INFO("id{0}: Completed full training and crossvalidation, over {1} batches. Approximate average final training Cost/CACost/Accuracy: {2}/{3}/{4}%. Average final testing training Cost/CACost/Accuracy: {5}/{6}/{7}%.",
@@ -806,10 +1053,6 @@ namespace Core {
 			total.m_testingBufferAverageCACost,
 			total.m_testingBufferAccuracy);
 
-		for (uint n = 0; n < CROSSVAL_COUNT; n++) {
-			delete networks[n];
-		}
-
 		genome->setMetrics(total);
 
 		return total;
@@ -827,6 +1070,8 @@ namespace Core {
 		mp_forwarder = new Utils::Forwarder(mp_rng, mp_assetManager);
 		mp_dataset = new Dataset();
 
+		INFO("Using {0} network kernels.", Kernels::getName(Kernels::getSelected()));
+
 		INFO("Central Controller initialised.");
 	}
 
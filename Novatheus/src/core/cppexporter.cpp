@@ -0,0 +1,229 @@
+#include "pch.h"
+#include "core/cppexporter.h"
+#include "core/network.h"
+
+namespace Core {
+	namespace {
+		// Hex float literals are exact, and valid C++17.
+		std::string literal(float value)
+		{
+			if (value == 0.0f) { return "0.0f"; }
+
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%af", (double)value);
+			return buffer;
+		}
+	}
+
+	bool CppExporter::writeToFile(std::ofstream & file, Dataset* dataset, const std::string& name)
+	{
+		if (dynamic_cast<FastSigmoid*>(r_network.mp_squishifier) == nullptr) {
+			WARN("id{0}: Only FastSigmoid networks can be exported.", r_network.getID());
+			return false;
+		}
+
+		// A hex literal can't hold nan or inf, and a network that has diverged isn't worth exporting anyway.
+		auto isFinite = [](float value) { return std::isfinite(value); };
+		const size_t finiteWeights = std::count_if(r_network.m_weights.begin(), r_network.m_weights.end(), isFinite);
+		const size_t finiteBiases = std::count_if(r_network.m_biases.begin(), r_network.m_biases.end(), isFinite);
+		if (finiteWeights != r_network.m_weights.size() || finiteBiases != r_network.m_biases.size()) {
+			WARN("id{0}: Can't export a network with non-finite parameters: {1} weights and {2} biases are nan or inf.",
+				r_network.getID(), r_network.m_weights.size() - finiteWeights, r_network.m_biases.size() - finiteBiases);
+			return false;
+		}
+
+		collectCheckSamples(dataset);
+		writeForward(file, name);
+		writeCheck(file, name);
+		return true;
+	}
+
+	void CppExporter::collectCheckSamples(Dataset* dataset)
+	{
+		m_checkInputs.clear();
+		m_checkOutputs.clear();
+
+		if (dataset != nullptr && dataset->getAlreadyInitialised() && !dataset->m_data.empty() && !dataset->m_data[0].m_batches.empty()) {
+			for (auto& sample : dataset->m_data[0].m_batches[0].m_samples) {
+				if (m_checkInputs.size() >= EXPORT_CHECK_SAMPLES) { break; }
+				m_checkInputs.emplace_back(r_network.m_inputCount);
+				for (uint i = 0; i < r_network.m_inputCount; i++) { m_checkInputs.back()[i] = sample.getInput(i); }
+			}
+		}
+		else {
+			std::mt19937 rng(0u);
+			std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+			for (uint s = 0; s < EXPORT_CHECK_SAMPLES; s++) {
+				m_checkInputs.emplace_back(r_network.m_inputCount);
+				for (auto& input : m_checkInputs.back()) { input = distribution(rng); }
+			}
+		}
+
+		// The engine's own single-sample path is both the reference and the baseline to beat.
+		const uint repeats = 200u;
+		auto start = std::chrono::steady_clock::now();
+		for (uint r = 0; r < repeats; r++) {
+			for (auto& inputs : m_checkInputs) { r_network.runNetwork(inputs); }
+		}
+		double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (double)(repeats * m_checkInputs.size());
+
+		for (auto& inputs : m_checkInputs) { m_checkOutputs.push_back(r_network.runNetwork(inputs)); }
+
+		INFO("id{0}: Network::runNetwork takes {1} us per sample here. Build the export with -DNOVATHEUS_CHECK to compare.", r_network.getID(), microseconds);
+	}
+
+	void CppExporter::writeForward(std::ofstream & file, const std::string& name)
+	{
+		const NetworkTopology& topology = *r_network.mp_topology;
+		const uint inputCount = r_network.m_inputCount;
+		const uint neuronCount = r_network.m_neuronCount;
+		const uint outputCount = r_network.m_outputCount;
+		const uint edgeCount = r_network.m_edgeCount;
+
+		// Comma-separated, EXPORT_VALUES_PER_LINE to a line.
+		auto writeArray = [&file](uint count, auto element) {
+			for (uint i = 0; i < count; i++) {
+				file << (((i % EXPORT_VALUES_PER_LINE) == 0) ? "\t\t\t" : " ") << element(i) << ",";
+				if (((i + 1) % EXPORT_VALUES_PER_LINE) == 0 || i + 1 == count) { file << "\n"; }
+			}
+		};
+
+		file << "// Forward pass of a trained Novatheus network: " << neuronCount << " neurons, " << edgeCount << " connections.\n";
+		file << "// Generated code. Build with -DNOVATHEUS_CHECK for a main() that checks it against the engine and times it.\n";
+		file << "\n";
+		file << "namespace " << name << " {\n";
+		file << "\tconstexpr unsigned inputCount = " << inputCount << "u;\n";
+		file << "\tconstexpr unsigned outputCount = " << outputCount << "u;\n";
+		file << "\n";
+		file << "\tnamespace {\n";
+		file << "\t\tconstexpr unsigned neuronCount = " << neuronCount << "u;\n";
+		file << "\n";
+		file << "\t\t// FastSigmoid.\n";
+		file << "\t\tinline float squish(float x) {\n";
+		file << "\t\t\tfloat t = (x < 0.0f) ? 2.0f * (1.0f - x) : 2.0f * (1.0f + x);\n";
+		file << "\t\t\treturn (x / t) + 0.5f;\n";
+		file << "\t\t}\n";
+
+		// Neurons are in index order, which is topological, and the inputs come first in the value array, so source indices
+		// are the topology's own. They fit 16 bits for any genome with fewer than 65536 values.
+		const bool shortSources = (r_network.m_valueBufferSize <= 65536u);
+
+		// Every row is padded with zero weights on input 0 to a nonzero multiple of 4 connections. The generated loop then
+		// has no remainder loop to mispredict, and no neuron needs a branch around it.
+		std::vector<uint> paddedEnds, paddedSources;
+		std::vector<float> paddedWeights;
+		for (uint n = 0; n < neuronCount; n++) {
+			for (uint e = topology.m_rowOffsets[n]; e < topology.m_rowOffsets[n + 1]; e++) {
+				paddedSources.push_back(topology.m_sourceIndices[e]);
+				paddedWeights.push_back(r_network.m_weights[e]);
+			}
+			do {
+				paddedSources.push_back(0u);
+				paddedWeights.push_back(0.0f);
+			} while ((paddedSources.size() % 4) != 0);
+			paddedEnds.push_back((uint)paddedSources.size());
+		}
+
+		file << "\n";
+		file << "\t\tconstexpr unsigned paddedEdgeCount = " << paddedSources.size() << "u;\n";
+		file << "\n";
+		file << "\t\t// Per neuron: one past its last connection.\n";
+		file << "\t\tconstexpr unsigned rowEnds[neuronCount] = {\n";
+		writeArray(neuronCount, [&paddedEnds](uint n) { return std::to_string(paddedEnds[n]) + "u"; });
+		file << "\t\t};\n";
+		file << "\n";
+		file << "\t\tconstexpr float biases[neuronCount] = {\n";
+		writeArray(neuronCount, [this](uint n) { return literal(r_network.m_biases[n]); });
+		file << "\t\t};\n";
+		file << "\n";
+		file << "\t\t// Per connection: where its source sits in the value array, inputs first, then neurons.\n";
+		file << "\t\tconstexpr " << (shortSources ? "unsigned short" : "unsigned") << " sources[paddedEdgeCount] = {\n";
+		writeArray((uint)paddedSources.size(), [&paddedSources](uint e) { return std::to_string(paddedSources[e]) + "u"; });
+		file << "\t\t};\n";
+		file << "\n";
+		file << "\t\talignas(64) constexpr float weights[paddedEdgeCount] = {\n";
+		writeArray((uint)paddedWeights.size(), [&paddedWeights](uint e) { return literal(paddedWeights[e]); });
+		file << "\t\t};\n";
+		file << "\t}\n";
+
+		// Four partial sums per neuron, so that consecutive multiply-adds don't wait on each other.
+		file << "\n";
+		file << "\t// in: inputCount values. out: outputCount values.\n";
+		file << "\tinline void forward(const float* in, float* out) {\n";
+		file << "\t\tfloat x[inputCount + neuronCount];\n";
+		file << "\t\tfor (unsigned i = 0; i < inputCount; i++) { x[i] = in[i]; }\n";
+		file << "\n";
+		file << "\t\tunsigned e = 0;\n";
+		file << "\t\tfor (unsigned n = 0; n < neuronCount; n++) {\n";
+		file << "\t\t\tconst unsigned end = rowEnds[n];\n";
+		file << "\t\t\tfloat a0 = biases[n], a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;\n";
+		file << "\t\t\tdo {\n";
+		file << "\t\t\t\ta0 += weights[e] * x[sources[e]];\n";
+		file << "\t\t\t\ta1 += weights[e + 1u] * x[sources[e + 1u]];\n";
+		file << "\t\t\t\ta2 += weights[e + 2u] * x[sources[e + 2u]];\n";
+		file << "\t\t\t\ta3 += weights[e + 3u] * x[sources[e + 3u]];\n";
+		file << "\t\t\t\te += 4u;\n";
+		file << "\t\t\t} while (e < end);\n";
+		file << "\t\t\tx[inputCount + n] = squish((a0 + a2) + (a1 + a3));\n";
+		file << "\t\t}\n";
+		file << "\n";
+		file << "\t\tfor (unsigned o = 0; o < outputCount; o++) { out[o] = x[inputCount + neuronCount - outputCount + o]; }\n";
+		file << "\t}\n";
+		file << "}\n";
+	}
+
+	void CppExporter::writeCheck(std::ofstream & file, const std::string& name)
+	{
+		auto writeRows = [&file](const std::vector<std::vector<float>>& rows) {
+			for (auto& row : rows) {
+				file << "\t\t{ ";
+				for (size_t i = 0; i < row.size(); i++) { file << ((i > 0) ? ", " : "") << literal(row[i]); }
+				file << " },\n";
+			}
+		};
+
+		file << "\n#ifdef NOVATHEUS_CHECK\n";
+		file << "#include <chrono>\n";
+		file << "#include <cmath>\n";
+		file << "#include <cstdio>\n";
+		file << "\n";
+		file << "namespace {\n";
+		file << "\tconstexpr unsigned checkSamples = " << m_checkInputs.size() << "u;\n";
+		file << "\tconstexpr float checkTolerance = 1e-4f; // The engine sums each neuron's inputs in SIMD lanes, so not in the same order.\n";
+		file << "\n";
+		file << "\tconst float checkInputs[checkSamples][" << name << "::inputCount] = {\n";
+		writeRows(m_checkInputs);
+		file << "\t};\n";
+		file << "\n";
+		file << "\t// From Network::runNetwork.\n";
+		file << "\tconst float checkOutputs[checkSamples][" << name << "::outputCount] = {\n";
+		writeRows(m_checkOutputs);
+		file << "\t};\n";
+		file << "}\n";
+		file << "\n";
+		file << "int main() {\n";
+		file << "\tfloat out[" << name << "::outputCount];\n";
+		file << "\tfloat worst = 0.0f;\n";
+		file << "\tfor (unsigned s = 0; s < checkSamples; s++) {\n";
+		file << "\t\t" << name << "::forward(checkInputs[s], out);\n";
+		file << "\t\tfor (unsigned o = 0; o < " << name << "::outputCount; o++) { worst = std::fmax(worst, std::fabs(out[o] - checkOutputs[s][o])); }\n";
+		file << "\t}\n";
+		file << "\n";
+		file << "\tconst unsigned repeats = 2000u;\n";
+		file << "\tfloat sink = 0.0f;\n";
+		file << "\tauto start = std::chrono::steady_clock::now();\n";
+		file << "\tfor (unsigned r = 0; r < repeats; r++) {\n";
+		file << "\t\tfor (unsigned s = 0; s < checkSamples; s++) {\n";
+		file << "\t\t\t" << name << "::forward(checkInputs[s], out);\n";
+		file << "\t\t\tsink += out[0];\n";
+		file << "\t\t}\n";
+		file << "\t}\n";
+		file << "\tdouble nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ((double)repeats * checkSamples);\n";
+		file << "\n";
+		file << "\tstd::printf(\"Largest difference from the engine's outputs: %g (tolerance %g).\\n\", worst, checkTolerance);\n";
+		file << "\tstd::printf(\"Forward pass: %.0f ns per sample (checksum %g).\\n\", nanoseconds, sink);\n";
+		file << "\treturn (worst <= checkTolerance) ? 0 : 1;\n";
+		file << "}\n";
+		file << "#endif\n";
+	}
+}
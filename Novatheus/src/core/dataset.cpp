@@ -2,6 +2,16 @@
 #include "core/dataset.h"
 
 namespace Core {
+	const float* Dataset::getPixelInputs()
+	{
+		static const std::array<float, 256> s_inputs = []() {
+			std::array<float, 256> inputs;
+			for (uint p = 0; p < 256; p++) { inputs[p] = pixelToInput((unsigned char)p); }
+			return inputs;
+		}();
+		return s_inputs.data();
+	}
+
 	bool Dataset::readIDXData(std::string dataFilePath, int dataMagicNumber, std::string labelFilePath, int labelMagicNumber)
 	{
 		if (m_alreadyInitialised) {
@@ -9,132 +19,194 @@ namespace Core {
 			return false;
 		}
 
-		// Files:
+		auto start = std::chrono::steady_clock::now();
 
-		std::ifstream dataFile, labelFile;
+		// Files, mapped rather than read in; their headers are checked as they are opened:
 
 		bool failure = false;
-		try {
-			dataFile.open("./data/" + dataFilePath, std::ios::binary);
-		}
-		catch (std::ios_base::failure& e) {
-			WARN("Data file {0} threw exception: {1}", "./data/" + dataFilePath, e.code().message());
-			failure = true;
-		}
-
-		try {
-			labelFile.open("./data/" + labelFilePath, std::ios::binary);
-		}
-		catch (std::ios_base::failure& e) {
-			WARN("Label file {0} threw exception: {1}", "./data/" + labelFilePath, e.code().message());
-			failure = true;
+		if (!m_imageFile.open("./data/" + dataFilePath, dataMagicNumber)) { WARN("Data file {0} failed to open", "Novatheus/data/" + dataFilePath); failure = true; }
+		if (!m_labelFile.open("./data/" + labelFilePath, labelMagicNumber)) { WARN("Label file {0} failed to open", "Novatheus/data/" + labelFilePath); failure = true; }
+		if (!failure && m_imageFile.getDimensions().size() != 3) { WARN("Data file {0} does not hold images: it has {1} dimensions, not 3.", dataFilePath, m_imageFile.getDimensions().size()); failure = true; }
+		if (!failure && m_labelFile.getItemSize() != 1) { WARN("Label file {0} does not hold one byte per label.", labelFilePath); failure = true; }
+		if (failure) {
+			m_imageFile.close();
+			m_labelFile.close();
+			return false;
 		}
-
-		if (!dataFile.is_open()) { WARN("Data file {0} failed to open", "Novatheus/data/" + dataFilePath); failure = true; }
-		if (!labelFile.is_open()) { WARN("Label file {0} failed to open", "Novatheus/data/" + labelFilePath); failure = true; }
-		if (failure) { return false; }
-		INFO("Files opened...");
-
-		// Magic numbers:
-
-		int inpDataMN, inpLabelMN;
-		readInt(dataFile, inpDataMN);
-		readInt(labelFile, inpLabelMN);
-		if (inpDataMN != dataMagicNumber) { WARN("Magic Number read from data file does not equal expected result. {0} != {1}", inpDataMN, dataMagicNumber); failure = true; }
-		if (inpLabelMN != labelMagicNumber) { WARN("Magic Number read from label file does not equal expected result. {0} != {1}", inpLabelMN, labelMagicNumber); failure = true; }
-		if (failure) { return false; }
-		INFO("Magic numbers match...");
+		INFO("Files opened, magic numbers match...");
 
 		// Metadata:
 
-		int imageCount = 0, imageRows = 0, imageColumns = 0;
-		readInt(dataFile, imageCount);
-		readInt(dataFile, imageRows);
-		readInt(dataFile, imageColumns);
-
-		int labelCount = 0;
-		readInt(labelFile, labelCount);
-
-		INFO("Data file contains {0} images, each of which is {1}x{2}px. Label file contains {3} labels.", imageCount, imageRows, imageColumns, labelCount);
+		const uint imageCount = m_imageFile.getItemCount(), labelCount = m_labelFile.getItemCount();
+		INFO("Data file contains {0} images, each of which is {1}x{2}px. Label file contains {3} labels.", imageCount, m_imageFile.getDimensions()[1], m_imageFile.getDimensions()[2], labelCount);
 
 		if (imageCount != labelCount) {
 			WARN("Image/Label count mismatch! Invalid data files!");
+			m_imageFile.close();
+			m_labelFile.close();
 			return false;
 		}
 
-		uint imageContentsCount = imageRows * imageColumns; // How many floats in an image.
+		uint imageContentsCount = (uint)m_imageFile.getItemSize(); // How many pixels in an image.
 		uint minibatchCount = imageCount / MINIBATCH_COUNT;
 		uint crossvalSectionContentsCount = minibatchCount / CROSSVAL_COUNT; // How many minibatches in a crossval section.
 		uint leftovers = imageCount - (CROSSVAL_COUNT * crossvalSectionContentsCount * MINIBATCH_COUNT);
 
+		INFO("Data will be partitioned into {0} sections of {1} minibatches each. {2} samples will be left out and unused.", CROSSVAL_COUNT, crossvalSectionContentsCount, leftovers);
+		INFO("Beginning data retooling...");
+
+		m_sampleSize = imageContentsCount;
 		m_data.reserve(CROSSVAL_COUNT);
 		for (uint i = 0; i < CROSSVAL_COUNT; i++) { m_data.push_back(Section(crossvalSectionContentsCount)); }
 
-		INFO("Data will be partitioned into {0} sections of {1} minibatches each. {2} samples will be left out and unused.", CROSSVAL_COUNT, crossvalSectionContentsCount, leftovers);
-		INFO("Beginning data retooling...");
+		CacheHeader header;
+		header.m_sampleSize = imageContentsCount;
+		header.m_batchesPerSection = crossvalSectionContentsCount;
+		header.m_imageFileSize = m_imageFile.getFileSize();
+		header.m_labelFileSize = m_labelFile.getFileSize();
+		std::error_code error;
+		header.m_imageWriteTime = (long long)std::filesystem::last_write_time("./data/" + dataFilePath, error).time_since_epoch().count();
+		header.m_labelWriteTime = (long long)std::filesystem::last_write_time("./data/" + labelFilePath, error).time_since_epoch().count();
+
+		const std::string cachePath = "./cache/" + dataFilePath + ".cache";
+		const bool cached = readCache(cachePath, header);
+		if (!cached) {
+			uint emptyImages = retool(crossvalSectionContentsCount);
+			if (emptyImages > 0u) { WARN("{0} images detected to be entirely empty!", emptyImages); }
+			writeCache(cachePath, header);
+		}
+
+		m_alreadyInitialised = true;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double megabytes = (double)(m_imageFile.getFileSize() + m_labelFile.getFileSize()) / (1024.0 * 1024.0);
+		if (cached) { INFO("Dataset loaded from cache '{0}' in {1} ms. Pixels are read from the mapped files as they are first used.", cachePath, seconds * 1000.0); }
+		else { INFO("Data retooling complete. Dataset loaded: {0} MB in {1} ms, {2} MB/s.", megabytes, seconds * 1000.0, megabytes / std::max(seconds, 1e-9)); }
+
+		return true;
+	}
+
+	uint Dataset::retool(uint batchesPerSection)
+	{
+		// Each section on its own thread. Counting the active inputs is the first touch of each page of the mapping, so
+		// this is where the files are actually read.
+		std::vector<std::future<uint>> sections;
+		for (uint csi = 0; csi < CROSSVAL_COUNT; csi++) {
+			sections.emplace_back(std::async(std::launch::async, [this, csi, batchesPerSection]() {
+				uint sample = csi * batchesPerSection * MINIBATCH_COUNT;
+				uint emptyImages = 0u;
+
+				auto& cs = m_data[csi];
+				for (uint i = 0; i < batchesPerSection; i++) {
+					cs.m_batches.emplace_back();
+					auto& b = cs.m_batches.back();
+
+					for (auto& s : b.m_samples) {
+						s.p_pixels = m_imageFile.getItem(sample);
+						s.m_label = *m_labelFile.getItem(sample);
+						sample++;
+
+						uint activeInputs = 0u;
+						for (uint p = 0; p < m_sampleSize; p++) { if (s.p_pixels[p] != 0) { activeInputs++; } }
+
+						if (activeInputs == 0u) { emptyImages++; }
+						s.m_activeInputCount = activeInputs;
+						b.m_activeInputCount += activeInputs;
+					}
+				}
+				return emptyImages;
+			}));
+		}
+
+		uint emptyImages = 0u;
+		for (uint csi = 0; csi < CROSSVAL_COUNT; csi++) {
+			emptyImages += sections[csi].get();
+			INFO("Completed cross-validation section {0}...", csi + 1);
+		}
+		return emptyImages;
+	}
+
+	bool Dataset::readCache(const std::string& path, CacheHeader& expected)
+	{
+		if (!std::filesystem::exists(path)) {
+			INFO("No retooled data cached at '{0}'. It will be written once the data is retooled.", path);
+			return false;
+		}
 
-		bool filesFailed = false;
-		uint successfulImages = 0;
+		Utils::MappedFile cache;
+		if (!cache.open(path)) { return false; }
 
-		uint csi = 1;
+		const size_t sampleCount = (size_t)CROSSVAL_COUNT * expected.m_batchesPerSection * MINIBATCH_COUNT;
+		CacheHeader cached;
+		if (cache.getSize() == sizeof(CacheHeader) + sampleCount * sizeof(uint) + sampleCount) { std::memcpy(&cached, cache.getData(), sizeof(CacheHeader)); }
+		else { cached.m_magic = 0u; }
+
+		if (cached.m_magic != expected.m_magic || cached.m_version != expected.m_version ||
+			cached.m_minibatchCount != expected.m_minibatchCount || cached.m_crossvalCount != expected.m_crossvalCount ||
+			cached.m_sampleSize != expected.m_sampleSize || cached.m_batchesPerSection != expected.m_batchesPerSection ||
+			cached.m_imageFileSize != expected.m_imageFileSize || cached.m_labelFileSize != expected.m_labelFileSize) {
+			INFO("Cache '{0}' was written by another version, for other files or with other minibatches. Retooling.", path);
+			return false;
+		}
+		if (cached.m_imageWriteTime != expected.m_imageWriteTime || cached.m_labelWriteTime != expected.m_labelWriteTime) {
+			INFO("Data files have been written since cache '{0}' was. Retooling.", path);
+			return false;
+		}
+
+		const unsigned char* activeInputCounts = cache.getData() + sizeof(CacheHeader);
+		const unsigned char* labels = activeInputCounts + sampleCount * sizeof(uint);
+		uint sample = 0u;
 		for (auto& cs : m_data) {
-			//int bi = 0;
-			for (uint i = 0; i < crossvalSectionContentsCount && !filesFailed; i++) {
+			for (uint i = 0; i < expected.m_batchesPerSection; i++) {
 				cs.m_batches.emplace_back();
 				auto& b = cs.m_batches.back();
 
 				for (auto& s : b.m_samples) {
-					s.m_inputs.reserve(imageContentsCount);
-					
-					unsigned char label = 0;
-					labelFile.read((char*)&label, 1);
-
-					for (uint j = 0; j < OUTPUT_COUNT; j++) {
-						s.m_outputs[j] = (label == j) ? 0.9f : 0.1f;
-					}
-
-					bool totallyEmpty = true;
-
-					for (uint r = 0; r < imageRows && !filesFailed; r++) {
-						for (uint c = 0; c < imageColumns; c++) {
-							unsigned char pixel = 0;
-							dataFile.read((char*)&pixel, sizeof(pixel));
-
-							if (pixel == 0) { s.m_inputs.push_back(0.0f); }
-							else {
-								totallyEmpty = false;
-								
-								// Convert to float,
-								// then divide by 255 to convert to 0 to 1,
-								// then multiply by 0.8 and add 0.1 to convert to 0.1 to 0.9
-								// so as to avoid stressing the system.
-
-								float pixelData = (((float)pixel) * (0.8f / 255.0f)) + 0.1f; // And now it is 0.1 to 0.9.
-								s.m_inputs.push_back(pixelData);
-							}
-						}
-					}
-
-					if (totallyEmpty) { WARN("Image detected to be entirely empty!"); filesFailed = true; }
-					else { successfulImages++; }
+					s.p_pixels = m_imageFile.getItem(sample);
+					std::memcpy(&s.m_activeInputCount, activeInputCounts + (size_t)sample * sizeof(uint), sizeof(uint));
+					s.m_label = labels[sample];
+					sample++;
 
-					if (labelFile.eof()) { WARN("End of label file reached unexpectedly."); filesFailed = true; }
-					if (labelFile.fail()) { WARN("Label file byte retrieval detected failure."); filesFailed = true; }
-					if (dataFile.eof()) { WARN("End of data file reached unexpectedly."); filesFailed = true; }
-					if (dataFile.fail()) { WARN("Data file byte retrieval detected failure."); filesFailed = true; }
+					b.m_activeInputCount += s.m_activeInputCount;
 				}
+			}
+		}
+		return true;
+	}
 
-				//INFO("Completed batch {0}...", bi);
-				//bi++;
+	void Dataset::writeCache(const std::string& path, const CacheHeader& header)
+	{
+		std::filesystem::path file(path);
+		std::error_code error;
+		std::filesystem::create_directories(file.parent_path(), error);
+
+		// Written aside and renamed into place, so another process never maps half a cache.
+		std::string temporaryPath = path + ".tmp";
+		{
+			std::ofstream cache(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!cache.is_open()) {
+				WARN("Could not write cache '{0}'. The data will be retooled again next time.", path);
+				return;
 			}
 
-			INFO("Completed cross-validation section {0}...", csi);
-			csi++;
+			cache.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+			for (auto& cs : m_data) {
+				for (auto& b : cs.m_batches) {
+					for (auto& s : b.m_samples) { cache.write(reinterpret_cast<const char*>(&s.m_activeInputCount), sizeof(uint)); }
+				}
+			}
+			for (auto& cs : m_data) {
+				for (auto& b : cs.m_batches) {
+					for (auto& s : b.m_samples) { cache.write(reinterpret_cast<const char*>(&s.m_label), 1); }
+				}
+			}
+			if (!cache) {
+				WARN("Could not write cache '{0}'. The data will be retooled again next time.", path);
+				return;
+			}
 		}
 
-		m_alreadyInitialised = true;
-		INFO("Data retooling complete. Dataset loaded.");
-
-		return true;
+		std::filesystem::rename(temporaryPath, file, error);
+		if (error) { WARN("Could not move cache into place at '{0}': {1}", path, error.message()); }
+		else { INFO("Retooled data cached at '{0}'.", path); }
 	}
 }
\ No newline at end of file
@@ -0,0 +1,530 @@
+#include "pch.h"
+#include "core/foldnetwork.h"
+#include "core/batchpipeline.h"
+#include "core/genome.h"
+#include "core/kernels.h"
+
+namespace Core {
+	FoldNetwork::FoldNetwork(Genome * source, std::shared_ptr<const NetworkTopology> topology, Squishifier* squishifier, bool useJit) :
+		HasForwarder(source->getForwarder()),
+		mp_topology(std::move(topology)),
+		m_inputCount(mp_topology->m_inputCount),
+		m_outputCount(mp_topology->m_outputCount),
+		m_valueBufferSize(mp_topology->m_valueBufferSize),
+		m_neuronCount(mp_topology->m_neuronCount),
+		m_edgeCount(mp_topology->m_edgeCount),
+		m_startLRE(source->m_startLRExponent),
+		m_LRDelta(source->m_LRExponentDelta)
+	{
+		// Every fold starts from the genome's parameters.
+		m_weights.resize((size_t)m_edgeCount * CROSSVAL_COUNT);
+		for (uint e = 0; e < m_edgeCount; e++) {
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) { m_weights[(size_t)e * CROSSVAL_COUNT + f] = mp_topology->m_startingWeights[e]; }
+		}
+		m_biases.resize((size_t)m_neuronCount * CROSSVAL_COUNT);
+		for (uint n = 0; n < m_neuronCount; n++) {
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) { m_biases[(size_t)n * CROSSVAL_COUNT + f] = mp_topology->m_startingBiases[n]; }
+		}
+
+		m_weightGradients.assign((size_t)m_edgeCount * CROSSVAL_COUNT, 0.0f);
+		m_biasGradients.assign((size_t)m_neuronCount * CROSSVAL_COUNT, 0.0f);
+		m_values.assign((size_t)m_valueBufferSize * CROSSVAL_COUNT * MINIBATCH_COUNT, 0.0f);
+		m_delAdelZ.assign((size_t)m_neuronCount * CROSSVAL_COUNT * MINIBATCH_COUNT, 0.0f);
+		m_delCdelA.assign((size_t)m_neuronCount * CROSSVAL_COUNT * MINIBATCH_COUNT, 0.0f);
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			m_activeOffsets[f].assign(m_inputCount + 1, 0u);
+			// Enough for the densest minibatch that takes the skip-zero path, so transposeActiveInputs never reallocates.
+			m_activeSamples[f].reserve((size_t)(FOLD_SPARSE_INPUT_MAX_DENSITY * (float)(m_inputCount * MINIBATCH_COUNT)) + 1u);
+			m_activeValues[f].reserve(m_activeSamples[f].capacity());
+		}
+
+		mp_squishifier = (squishifier != nullptr) ? squishifier : new FastSigmoid();
+
+		// Only known types can be devirtualised from here; anything else goes through the virtual interface.
+		if (dynamic_cast<FastSigmoid*>(mp_squishifier) != nullptr) { mp_calculate = &FoldNetwork::calculate<FastSigmoid>; }
+		else { mp_calculate = &FoldNetwork::calculate<Squishifier>; }
+
+		m_LRDeltaPerBatch = m_LRDelta / (float)STANDARD_TRAINING_BATCH_COUNT;
+
+		if (useJit) { mp_forwardJit = ForwardJit::compile(*mp_topology, CROSSVAL_COUNT * MINIBATCH_COUNT, CROSSVAL_COUNT, true); }
+	}
+
+	FoldNetwork::~FoldNetwork()
+	{
+		delete mp_squishifier;
+		delete mp_threadPool;
+	}
+
+	void FoldNetwork::setThreadCount(uint threadCount)
+	{
+		delete mp_threadPool;
+		mp_threadPool = (threadCount > 1u) ? new Utils::ThreadPool(threadCount) : nullptr;
+	}
+
+	template <class SquishifierType>
+	void FoldNetwork::calculate(FoldNetwork& network, uint index, const Squishifier& squishifier, bool prepForBackprop)
+	{
+		const SquishifierType& s = static_cast<const SquishifierType&>(squishifier);
+		const NetworkTopology& topology = *network.mp_topology;
+		const uint* sources = topology.m_sourceIndices.data();
+		const float* weights = network.m_weights.data();
+		const float* values = network.m_values.data();
+		const size_t rowStride = (size_t)CROSSVAL_COUNT * MINIBATCH_COUNT;
+
+		// Folds with a minibatch this step.
+		uint folds[CROSSVAL_COUNT];
+		uint foldCount = 0u;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			if (network.mp_batches[f] != nullptr) { folds[foldCount++] = f; }
+		}
+
+		// [fold * MINIBATCH_COUNT + sample]. Input-reading edges were already summed into the output row by the input paths.
+		float z[CROSSVAL_COUNT * MINIBATCH_COUNT];
+		float* output = network.m_values.data() + (size_t)(network.m_inputCount + index) * rowStride;
+		const float* biases = network.m_biases.data() + (size_t)index * CROSSVAL_COUNT;
+		const uint split = topology.m_rowSplits[index];
+		for (uint k = 0; k < foldCount; k++) {
+			const uint begin = folds[k] * MINIBATCH_COUNT;
+			if (split > topology.m_rowOffsets[index]) {
+				for (uint i = begin; i < begin + MINIBATCH_COUNT; i++) { z[i] = biases[folds[k]] + output[i]; }
+			}
+			else {
+				for (uint i = begin; i < begin + MINIBATCH_COUNT; i++) { z[i] = biases[folds[k]]; }
+			}
+		}
+
+		ForwardJit::NeuronFunction sum = (network.mp_forwardJit != nullptr && Kernels::getSelected() >= Kernels::Level::AVX2) ?
+			network.mp_forwardJit->getNeuronFunction(index) : nullptr;
+		if (sum != nullptr) {
+			for (uint k = 0; k < foldCount; k++) { sum(values + folds[k] * MINIBATCH_COUNT, weights + folds[k], z + folds[k] * MINIBATCH_COUNT); }
+		}
+		else {
+			// The source index is loaded once for every fold.
+			const Kernels& kernels = Kernels::get();
+			for (uint e = split, end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+				const float* source = values + (size_t)sources[e] * rowStride;
+				const float* w = weights + (size_t)e * CROSSVAL_COUNT;
+				for (uint k = 0; k < foldCount; k++) {
+					kernels.mp_multiplyAdd(z + folds[k] * MINIBATCH_COUNT, source + folds[k] * MINIBATCH_COUNT, w[folds[k]], MINIBATCH_COUNT);
+				}
+			}
+		}
+
+		float* delAdelZ = network.m_delAdelZ.data() + (size_t)index * rowStride;
+		float* delCdelA = network.m_delCdelA.data() + (size_t)index * rowStride;
+		for (uint k = 0; k < foldCount; k++) {
+			const uint begin = folds[k] * MINIBATCH_COUNT;
+			if (prepForBackprop) {
+				for (uint i = begin; i < begin + MINIBATCH_COUNT; i++) {
+					delAdelZ[i] = s.getDerivative(z[i]);
+					delCdelA[i] = 0.0f;
+					output[i] = s.squish(z[i]);
+				}
+			}
+			else {
+				for (uint i = begin; i < begin + MINIBATCH_COUNT; i++) { output[i] = s.squish(z[i]); }
+			}
+		}
+	}
+
+	void FoldNetwork::runBackprop(uint index)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		const uint* sources = topology.m_sourceIndices.data();
+		const float* weights = m_weights.data();
+		const size_t rowStride = (size_t)CROSSVAL_COUNT * MINIBATCH_COUNT;
+
+		float* delCdelZ = m_delAdelZ.data() + (size_t)index * rowStride; // Overwritten in place.
+		float* delCdelA = m_delCdelA.data() + (size_t)index * rowStride;
+
+		// Pull from every consumer, as Neuron::runBackpropBatch does.
+		const Kernels& kernels = Kernels::get();
+		for (uint c = topology.m_fanOutOffsets[index], end = topology.m_fanOutOffsets[index + 1]; c < end; c++) {
+			const float* w = weights + (size_t)topology.m_fanOutEdges[c] * CROSSVAL_COUNT;
+			const float* consumer = m_delAdelZ.data() + (size_t)topology.m_fanOutNeurons[c] * rowStride;
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+				kernels.mp_multiplyAdd(delCdelA + f * MINIBATCH_COUNT, consumer + f * MINIBATCH_COUNT, w[f], MINIBATCH_COUNT);
+			}
+		}
+
+		// Bias
+		float* biasGradients = m_biasGradients.data() + (size_t)index * CROSSVAL_COUNT;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			float gradient = 0.0f;
+			for (uint i = f * MINIBATCH_COUNT; i < (f + 1) * MINIBATCH_COUNT; i++) {
+				delCdelZ[i] *= delCdelA[i];
+				gradient += delCdelZ[i];
+			}
+			biasGradients[f] += gradient;
+		}
+
+		// Weights. Input edges of skip-zero folds are left to accumulateSparseInputGradients, as their input rows aren't loaded.
+		const uint split = topology.m_rowSplits[index];
+		for (uint e = topology.m_rowOffsets[index], end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+			const float* source = m_values.data() + (size_t)sources[e] * rowStride;
+			float* gradients = m_weightGradients.data() + (size_t)e * CROSSVAL_COUNT;
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+				if (e < split && m_sparseFolds[f]) { continue; }
+				gradients[f] += kernels.mp_dot(source + f * MINIBATCH_COUNT, delCdelZ + f * MINIBATCH_COUNT, MINIBATCH_COUNT);
+			}
+		}
+	}
+
+	void FoldNetwork::endBatch(uint index, float learningRate)
+	{
+		const NetworkTopology& topology = *mp_topology;
+
+		// Bias;
+		for (size_t b = (size_t)index * CROSSVAL_COUNT; b < (size_t)(index + 1) * CROSSVAL_COUNT; b++) {
+			m_biases[b] -= (m_biasGradients[b] * learningRate) / (float)MINIBATCH_COUNT;
+			m_biasGradients[b] = 0.0f;
+		}
+
+		// Weights. Each row's folds are contiguous.
+		const size_t begin = (size_t)topology.m_rowOffsets[index] * CROSSVAL_COUNT;
+		const uint count = (topology.m_rowOffsets[index + 1] - topology.m_rowOffsets[index]) * CROSSVAL_COUNT;
+		Kernels::get().mp_update(m_weights.data() + begin, m_weightGradients.data() + begin, learningRate, (float)MINIBATCH_COUNT, count);
+	}
+
+	void FoldNetwork::runBatches(bool prepForBackprop)
+	{
+		const NetworkTopology& topology = *mp_topology;
+
+		// Each fold takes the skip-zero path or the input block by its own minibatch's density, as in Network::runBatch.
+		uint denseFolds[CROSSVAL_COUNT];
+		uint denseCount = 0u;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			m_sparseFolds[f] = (mp_batches[f] != nullptr) &&
+				(float)mp_batches[f]->m_activeInputCount <= FOLD_SPARSE_INPUT_MAX_DENSITY * (float)(m_inputCount * MINIBATCH_COUNT);
+			if (mp_batches[f] != nullptr && !m_sparseFolds[f]) { denseFolds[denseCount++] = f; }
+		}
+
+		// Batches are only ever read, so they are not locked; a fold may well share one with another genome's folds.
+		auto inputRange = [&](uint begin, uint end) {
+			for (uint f = begin; f < end; f++) {
+				if (mp_batches[f] == nullptr) { continue; }
+
+				if (m_sparseFolds[f]) { runSparseInputs(f); }
+				else { loadInputs(f); }
+			}
+		};
+		forEachFold(inputRange);
+
+		if (denseCount > 0u) {
+			auto tileRange = [&](uint begin, uint end) {
+				for (uint t = begin; t < end; t++) { runInputTile(t, denseFolds, denseCount); }
+			};
+
+			uint tileCount = (uint)topology.m_inputTileOffsets.size() - 1;
+			if (mp_threadPool != nullptr && (unsigned long long)topology.m_inputTileEdges.size() * denseCount * MINIBATCH_COUNT >= PARALLEL_LEVEL_MIN_WORK) {
+				mp_threadPool->parallelFor(tileCount, tileRange);
+			}
+			else { tileRange(0u, tileCount); }
+		}
+
+		// Run forwards, one level at a time;
+		for (uint l = 0; l < topology.m_levelCount; l++) {
+			const uint* neurons = topology.m_levelNeurons.data() + topology.m_levelOffsets[l];
+			auto calculateRange = [&](uint begin, uint end) {
+				for (uint k = begin; k < end; k++) { mp_calculate(*this, neurons[k], *mp_squishifier, prepForBackprop); }
+			};
+
+			uint count = topology.m_levelOffsets[l + 1] - topology.m_levelOffsets[l];
+			if (isWorthSplitting(l)) { mp_threadPool->parallelFor(count, calculateRange); }
+			else { calculateRange(0u, count); }
+		}
+	}
+
+	void FoldNetwork::loadInputs(uint fold)
+	{
+		// Decode and transpose the samples into the fold's columns of the input rows.
+		const float* decode = Dataset::getPixelInputs();
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			const unsigned char* pixels = mp_batches[fold]->m_samples[s].p_pixels;
+			for (uint i = 0; i < m_inputCount; i++) { m_values[((size_t)i * CROSSVAL_COUNT + fold) * MINIBATCH_COUNT + s] = decode[pixels[i]]; }
+		}
+	}
+
+	void FoldNetwork::runInputTile(uint tile, const uint* folds, uint foldCount)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		const uint* sources = topology.m_sourceIndices.data();
+		const size_t rowStride = (size_t)CROSSVAL_COUNT * MINIBATCH_COUNT;
+
+		uint first = tile * INPUT_TILE_NEURONS;
+		uint last = std::min(first + INPUT_TILE_NEURONS, (uint)topology.m_inputNeurons.size());
+		for (uint k = first; k < last; k++) {
+			float* row = m_values.data() + (size_t)(m_inputCount + topology.m_inputNeurons[k]) * rowStride;
+			for (uint i = 0; i < foldCount; i++) { std::fill_n(row + folds[i] * MINIBATCH_COUNT, MINIBATCH_COUNT, 0.0f); }
+		}
+
+		// Entries are sorted by input, so consecutive entries mostly reuse the same (cached) input row, and each entry's
+		// source index is loaded once for every fold.
+		const Kernels& kernels = Kernels::get();
+		for (uint entry = topology.m_inputTileOffsets[tile], end = topology.m_inputTileOffsets[tile + 1]; entry < end; entry++) {
+			const uint e = topology.m_inputTileEdges[entry];
+			const float* w = m_weights.data() + (size_t)e * CROSSVAL_COUNT;
+			const float* source = m_values.data() + (size_t)sources[e] * rowStride;
+			float* row = m_values.data() + (size_t)(m_inputCount + topology.m_inputTileNeurons[entry]) * rowStride;
+			for (uint i = 0; i < foldCount; i++) {
+				const uint offset = folds[i] * MINIBATCH_COUNT;
+				kernels.mp_multiplyAdd(row + offset, source + offset, w[folds[i]], MINIBATCH_COUNT);
+			}
+		}
+	}
+
+	void FoldNetwork::runSparseInputs(uint fold)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		const size_t rowStride = (size_t)CROSSVAL_COUNT * MINIBATCH_COUNT;
+		float* values = m_values.data() + (size_t)m_inputCount * rowStride + (size_t)fold * MINIBATCH_COUNT; // Fold's column of neuron 0.
+		for (uint n : topology.m_inputNeurons) { std::fill_n(values + (size_t)n * rowStride, MINIBATCH_COUNT, 0.0f); }
+
+		// Input-major, from the transposed inputs, so that each edge's weight is loaded once and its neuron's row is written in
+		// one go. Every neuron still sums its input edges in input order.
+		transposeActiveInputs(fold);
+		const uint* offsets = m_activeOffsets[fold].data();
+		const uint* samples = m_activeSamples[fold].data();
+		const float* inputs = m_activeValues[fold].data();
+		for (uint i = 0; i < m_inputCount; i++) {
+			if (offsets[i] == offsets[i + 1]) { continue; }
+
+			for (uint o = topology.m_inputFanOutOffsets[i]; o < topology.m_inputFanOutOffsets[i + 1]; o++) {
+				float* row = values + (size_t)topology.m_inputFanOutNeurons[o] * rowStride;
+				const float w = m_weights[(size_t)topology.m_inputFanOutEdges[o] * CROSSVAL_COUNT + fold];
+				for (uint a = offsets[i]; a < offsets[i + 1]; a++) { row[samples[a]] += w * inputs[a]; }
+			}
+		}
+	}
+
+	void FoldNetwork::transposeActiveInputs(uint fold)
+	{
+		const Batch& batch = *mp_batches[fold];
+		std::vector<uint>& offsets = m_activeOffsets[fold];
+		std::fill(offsets.begin(), offsets.end(), 0u);
+		for (auto& sample : batch.m_samples) {
+			sample.forEachActiveInput(m_inputCount, [&offsets](uint input, float) { offsets[input + 1]++; });
+		}
+		for (uint i = 0; i < m_inputCount; i++) { offsets[i + 1] += offsets[i]; }
+
+		m_activeSamples[fold].resize(batch.m_activeInputCount);
+		m_activeValues[fold].resize(batch.m_activeInputCount);
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			batch.m_samples[s].forEachActiveInput(m_inputCount, [&, s](uint input, float x) {
+				uint slot = offsets[input]++;
+				m_activeSamples[fold][slot] = s;
+				m_activeValues[fold][slot] = x;
+			});
+		}
+		// The fill pass left each offset at the start of the next input; shift back.
+		for (uint i = m_inputCount; i > 0; i--) { offsets[i] = offsets[i - 1]; }
+		offsets[0] = 0u;
+	}
+
+	void FoldNetwork::accumulateSparseInputGradients()
+	{
+		const NetworkTopology& topology = *mp_topology;
+		const size_t rowStride = (size_t)CROSSVAL_COUNT * MINIBATCH_COUNT;
+
+		uint sparseFolds[CROSSVAL_COUNT];
+		uint sparseCount = 0u;
+		size_t activeCount = 0u;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			if (!m_sparseFolds[f]) { continue; }
+			sparseFolds[sparseCount++] = f;
+			activeCount += m_activeSamples[f].size();
+		}
+		if (sparseCount == 0u) { return; }
+
+		// Edges of different inputs are disjoint, so inputs split across threads without conflict.
+		auto inputRange = [&](uint begin, uint end) {
+			for (uint i = begin; i < end; i++) {
+				for (uint o = topology.m_inputFanOutOffsets[i]; o < topology.m_inputFanOutOffsets[i + 1]; o++) {
+					const float* delCdelZ = m_delAdelZ.data() + (size_t)topology.m_inputFanOutNeurons[o] * rowStride;
+					float* gradients = m_weightGradients.data() + (size_t)topology.m_inputFanOutEdges[o] * CROSSVAL_COUNT;
+					for (uint k = 0; k < sparseCount; k++) {
+						const uint f = sparseFolds[k];
+						const float* foldDelCdelZ = delCdelZ + f * MINIBATCH_COUNT;
+						float gradient = 0.0f;
+						for (uint a = m_activeOffsets[f][i]; a < m_activeOffsets[f][i + 1]; a++) {
+							gradient += m_activeValues[f][a] * foldDelCdelZ[m_activeSamples[f][a]];
+						}
+						gradients[f] += gradient;
+					}
+				}
+			}
+		};
+
+		if (mp_threadPool != nullptr && (unsigned long long)activeCount * (topology.m_inputFanOutEdges.size() / std::max(m_inputCount, 1u)) >= PARALLEL_LEVEL_MIN_WORK) {
+			mp_threadPool->parallelFor(m_inputCount, inputRange);
+		}
+		else { inputRange(0u, m_inputCount); }
+	}
+
+	std::tuple<float, float, float> FoldNetwork::scoreFold(uint fold, bool setOutputDeltas)
+	{
+		// CA == 'Correct Answer'
+		float batchAverageCost = 0.0f;
+		float batchCAAverageCost = 0.0f;
+		uint CASamples = 0u;
+
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			// Per sample
+			auto& sample = mp_batches[fold]->m_samples[s];
+
+			float cost = 0.0f;
+
+			float highestOutputVal = 0.0f;
+			uint highestOutputIndex = 0u;
+			uint correctOutputIndex = 0u;
+
+			for (uint i = 0; i < m_outputCount; i++) {
+				uint neuron = m_neuronCount - (i + 1);
+				float output = m_values[((size_t)(m_valueBufferSize - (i + 1)) * CROSSVAL_COUNT + fold) * MINIBATCH_COUNT + s];
+				float* delCdelA = &m_delCdelA[((size_t)neuron * CROSSVAL_COUNT + fold) * MINIBATCH_COUNT + s];
+				float target = sample.getTarget(m_outputCount - (i + 1));
+				bool isCorrectOutput = (target > 0.5f);
+
+				float diff = output - target;
+				float partialCost = diff * diff;
+
+				// Cost of the true output is multiplied by 5.
+				if (isCorrectOutput) {
+					if (setOutputDeltas) { *delCdelA = 10.0f * diff; }
+					partialCost *= 5.0f;
+				}
+				else if (setOutputDeltas) { *delCdelA = 2.0f * diff; }
+
+				cost += partialCost;
+
+				if (output > highestOutputVal) {
+					highestOutputVal = output;
+					highestOutputIndex = m_outputCount - (i + 1);
+				}
+
+				if (isCorrectOutput) {
+					correctOutputIndex = m_outputCount - (i + 1);
+					batchCAAverageCost += partialCost;
+				}
+			}
+
+			batchAverageCost += cost;
+
+			if (highestOutputIndex == correctOutputIndex) { CASamples++; }
+		}
+
+		batchAverageCost /= (float)MINIBATCH_COUNT;
+		batchCAAverageCost /= (float)MINIBATCH_COUNT;
+		float caPercentage = (100.0f * (float)CASamples) / (float)MINIBATCH_COUNT;
+
+		return std::make_tuple(batchAverageCost, batchCAAverageCost, caPercentage);
+	}
+
+	void FoldNetwork::trainStep(float learningRate)
+	{
+		const NetworkTopology& topology = *mp_topology;
+
+		runBatches(true);
+
+		std::array<std::tuple<float, float, float>, CROSSVAL_COUNT> results;
+		auto scoreRange = [&](uint begin, uint end) {
+			for (uint f = begin; f < end; f++) { results[f] = scoreFold(f, true); }
+		};
+		forEachFold(scoreRange);
+
+		// Run backwards, for every fold's minibatch at once.
+		for (uint l = topology.m_levelCount; l-- > 0;) {
+			const uint* neurons = topology.m_levelNeurons.data() + topology.m_levelOffsets[l];
+			auto backpropRange = [&](uint begin, uint end) {
+				for (uint k = begin; k < end; k++) { runBackprop(neurons[k]); }
+			};
+
+			uint count = topology.m_levelOffsets[l + 1] - topology.m_levelOffsets[l];
+			if (isWorthSplitting(l)) { mp_threadPool->parallelFor(count, backpropRange); }
+			else { backpropRange(0u, count); }
+		}
+		accumulateSparseInputGradients();
+
+		auto endRange = [&](uint begin, uint end) {
+			for (uint n = begin; n < end; n++) { endBatch(n, learningRate); }
+		};
+		if (mp_threadPool != nullptr) { mp_threadPool->parallelFor(m_neuronCount, endRange); }
+		else { endRange(0u, m_neuronCount); }
+
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			m_costBuffer[f].push(std::get<0>(results[f]));
+			m_CACostBuffer[f].push(std::get<1>(results[f]));
+			m_accuracyBuffer[f].push(std::get<2>(results[f]));
+		}
+
+		m_trainedBatches++;
+	}
+
+	std::array<Metrics, CROSSVAL_COUNT> FoldNetwork::trainFromDataset(Dataset* dataset, const std::array<SectionMask, CROSSVAL_COUNT>& crossvalidationSections, const std::array<uint, CROSSVAL_COUNT>& batchOffsets, uint batches)
+	{
+		// Do actual training. Every fold trains for the same number of batches, so they stay in step throughout.
+		// One pipeline prepares every fold's minibatches, a lane each.
+		BatchPipeline pipeline(*dataset, crossvalidationSections, batchOffsets, batches);
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			if (pipeline.getEpochSampleCount(f) == 0u) {
+				WARN("id{0}: Fold {1} has no minibatches to train on outside its testing sections. Training skipped.", getID(), f);
+				return std::array<Metrics, CROSSVAL_COUNT>();
+			}
+		}
+
+		for (uint b = 0; b < batches; b++) {
+			float learningRate = m_startLRE + (m_trainedBatches * m_LRDeltaPerBatch);
+			learningRate = std::pow(2.0f, learningRate);
+
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) { mp_batches[f] = &pipeline.acquire(f).m_batch; }
+			trainStep(learningRate);
+			pipeline.release();
+		}
+
+		// Testing. Folds may have different amounts of testing data; those that run out sit the remaining steps out.
+		std::array<std::vector<Batch*>, CROSSVAL_COUNT> tests;
+		size_t testSteps = 0;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			for (uint s = 0; s < CROSSVAL_COUNT; ++s) {
+				if (crossvalidationSections[f][s]) {
+					for (auto& b : dataset->m_data[s].m_batches) { tests[f].push_back(&b); }
+				}
+			}
+			testSteps = std::max(testSteps, tests[f].size());
+		}
+
+		std::array<std::tuple<float, float, float>, CROSSVAL_COUNT> testTotals {};
+		for (size_t t = 0; t < testSteps; t++) {
+			for (uint f = 0; f < CROSSVAL_COUNT; f++) { mp_batches[f] = (t < tests[f].size()) ? tests[f][t] : nullptr; }
+			runBatches(false);
+
+			auto scoreRange = [&](uint begin, uint end) {
+				for (uint f = begin; f < end; f++) {
+					if (mp_batches[f] == nullptr) { continue; }
+
+					auto output = scoreFold(f, false);
+					std::get<0>(testTotals[f]) += std::get<0>(output);
+					std::get<1>(testTotals[f]) += std::get<1>(output);
+					std::get<2>(testTotals[f]) += std::get<2>(output);
+				}
+			};
+			forEachFold(scoreRange);
+		}
+		mp_batches.fill(nullptr);
+
+		// Metrics, per fold.
+		std::array<Metrics, CROSSVAL_COUNT> metrics;
+		for (uint f = 0; f < CROSSVAL_COUNT; f++) {
+			float trainingBufferAverageCost = m_costBuffer[f].getAverage();
+			float trainingBufferAverageCACost = m_CACostBuffer[f].getAverage();
+			float trainingBufferAccuracy = m_accuracyBuffer[f].getAverage();
+
+			float testedBatches = (float)tests[f].size();
+			metrics[f] = Metrics(trainingBufferAverageCost, trainingBufferAverageCACost, trainingBufferAccuracy,
+				std::get<0>(testTotals[f]) / testedBatches, std::get<1>(testTotals[f]) / testedBatches, std::get<2>(testTotals[f]) / testedBatches);
+		}
+
+		return metrics;
+	}
+
+}
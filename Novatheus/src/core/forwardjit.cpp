@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "core/forwardjit.h"
+#include "core/topology.h"
+#include "utils/cpu.h"
+
+// System V only. On Windows, functions that move rsp or save xmm6 to xmm15 must register unwind data, which this does not.
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define FORWARD_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Core {
+	namespace {
+		// Argument registers of NeuronFunction, System V.
+		const uint c_values = 7u, c_weights = 6u, c_sums = 2u;		// rdi, rsi, rdx. No vector registers are callee-saved.
+
+		// Whether the code can run here is the same for every call, so the reason it can't is logged once per process.
+		std::atomic<bool> s_refused(false);
+
+		// VEX encodings, always in the three-byte form. Registers are numbered 0 to 15; every memory operand is [base + disp32],
+		// with a base that is never rsp or r12, so no SIB byte.
+		class Assembler {
+		public:
+			enum Map : uint { Map0F = 1u, Map0F38 = 2u };
+			enum Prefix : uint { PrefixNone = 0u, Prefix66 = 1u, PrefixF3 = 2u };
+
+			std::vector<unsigned char> m_code;
+
+			// Floats moved or multiplied per instruction: 8 (ymm), 4 (xmm) or 1 (the low lane).
+			void load(uint reg, uint base, int disp, uint width) { memoryInstruction(0x10, reg, 0u, base, disp, Map0F, (width == 1u) ? PrefixF3 : PrefixNone, width == 8u); }
+			void store(uint reg, uint base, int disp, uint width) { memoryInstruction(0x11, reg, 0u, base, disp, Map0F, (width == 1u) ? PrefixF3 : PrefixNone, width == 8u); }
+			void broadcast(uint reg, uint base, int disp, bool wide) { memoryInstruction(0x18, reg, 0u, base, disp, Map0F38, Prefix66, wide); }
+			void multiplyAdd(uint accumulator, uint multiplier, uint base, int disp, uint width) { // accumulator += multiplier * [base + disp].
+				memoryInstruction((width == 1u) ? 0xB9 : 0xB8, accumulator, multiplier, base, disp, Map0F38, Prefix66, width == 8u);
+			}
+
+			void returnFromFunction() { emit({ 0xC5, 0xF8, 0x77, 0xC3 }); } // vzeroupper, so the caller's SSE code pays no transition penalty; ret.
+			void align(size_t alignment) { while ((m_code.size() % alignment) != 0) { m_code.push_back(0xCC); } }
+		private:
+			void emit(std::initializer_list<unsigned char> bytes) { m_code.insert(m_code.end(), bytes); }
+			void immediate(int value) { for (uint b = 0; b < 4; b++) { m_code.push_back((unsigned char)(((unsigned int)value >> (b * 8)) & 0xFFu)); } }
+
+			void memoryInstruction(unsigned char opcode, uint reg, uint vvvv, uint base, int disp, Map map, Prefix prefix, bool wide)
+			{
+				// R and B extend reg and base to 16 registers, inverted; X is unused, also inverted.
+				m_code.push_back(0xC4);
+				m_code.push_back((unsigned char)((((reg >> 3) ^ 1u) << 7) | (1u << 6) | (((base >> 3) ^ 1u) << 5) | map));
+				m_code.push_back((unsigned char)(((~vvvv & 0xFu) << 3) | ((wide ? 1u : 0u) << 2) | prefix));
+				m_code.push_back(opcode);
+				m_code.push_back((unsigned char)(0x80u | ((reg & 7u) << 3) | (base & 7u)));
+				immediate(disp);
+			}
+		};
+	}
+
+	std::unique_ptr<const ForwardJit> ForwardJit::compile(const NetworkTopology& topology, uint valueRowStride, uint weightStride, bool neuronEdgesOnly)
+	{
+#ifndef FORWARD_JIT_SUPPORTED
+		if (!s_refused.exchange(true)) { WARN("The forward pass JIT only targets x86-64 System V. Using the kernels."); }
+		return nullptr;
+#else
+		const Utils::CpuFeatures& cpu = Utils::CpuFeatures::get();
+		if (!cpu.m_avx2 || !cpu.m_fma) {
+			if (!s_refused.exchange(true)) { WARN("The forward pass JIT needs AVX2 and FMA, which this machine lacks. Using the kernels."); }
+			return nullptr;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		// A minibatch row as registers: whole ymm first, then at most one xmm, then single lanes.
+		std::vector<uint> widths;
+		for (uint s = 0; s < MINIBATCH_COUNT; ) {
+			uint width = (MINIBATCH_COUNT - s >= 8u) ? 8u : (MINIBATCH_COUNT - s >= 4u) ? 4u : 1u;
+			widths.push_back(width);
+			s += width;
+		}
+		const uint weightRegister = (uint)widths.size();
+		if (weightRegister > 15u) {
+			if (!s_refused.exchange(true)) { WARN("A minibatch of {0} samples needs more than 16 vector registers. Using the kernels.", MINIBATCH_COUNT); }
+			return nullptr;
+		}
+		const int rowBytes = (int)(valueRowStride * sizeof(float));
+		const int weightBytes = (int)(weightStride * sizeof(float));
+
+		Assembler a;
+		size_t compiledEdges = 0u;
+		std::vector<size_t> offsets(topology.m_neuronCount + 1, 0u);
+		for (uint n = 0; n < topology.m_neuronCount; n++) {
+			offsets[n] = a.m_code.size();
+			const uint first = neuronEdgesOnly ? topology.m_rowSplits[n] : topology.m_rowOffsets[n];
+			if (first == topology.m_rowOffsets[n + 1]) { continue; }
+			compiledEdges += topology.m_rowOffsets[n + 1] - first;
+
+			int sample = 0;
+			for (uint r = 0; r < weightRegister; r++) {
+				a.load(r, c_sums, sample * (int)sizeof(float), widths[r]);
+				sample += (int)widths[r];
+			}
+
+			for (uint e = first, end = topology.m_rowOffsets[n + 1]; e < end; e++) {
+				a.broadcast(weightRegister, c_weights, (int)e * weightBytes, widths[0] == 8u);
+				sample = 0;
+				for (uint r = 0; r < weightRegister; r++) {
+					a.multiplyAdd(r, weightRegister, c_values, (int)topology.m_sourceIndices[e] * rowBytes + sample * (int)sizeof(float), widths[r]);
+					sample += (int)widths[r];
+				}
+			}
+
+			sample = 0;
+			for (uint r = 0; r < weightRegister; r++) {
+				a.store(r, c_sums, sample * (int)sizeof(float), widths[r]);
+				sample += (int)widths[r];
+			}
+
+			a.returnFromFunction();
+			a.align(16);
+		}
+		offsets[topology.m_neuronCount] = a.m_code.size();
+
+		if (a.m_code.size() > ((size_t)JIT_MAX_CODE_MB << 20)) {
+			WARN("JIT forward pass would take {0} MB of code, over the limit of {1} MB. Using the kernels.", a.m_code.size() >> 20, JIT_MAX_CODE_MB);
+			return nullptr;
+		}
+
+		// Written while writable, then flipped to executable, so the pages are never both.
+		std::unique_ptr<ForwardJit> jit(new ForwardJit());
+		jit->m_codeSize = std::max(a.m_code.size(), (size_t)1u);
+		void* code = mmap(nullptr, jit->m_codeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (code == MAP_FAILED) {
+			WARN("Could not allocate {0} KB for the JIT forward pass. Using the kernels.", jit->m_codeSize / 1024);
+			return nullptr;
+		}
+		jit->mp_code = code;
+		std::memcpy(jit->mp_code, a.m_code.data(), a.m_code.size());
+		if (mprotect(jit->mp_code, jit->m_codeSize, PROT_READ | PROT_EXEC) != 0) {
+			// Eg. under a W^X policy. The destructor unmaps it.
+			WARN("Could not make the JIT forward pass executable. Using the kernels.");
+			return nullptr;
+		}
+
+		unsigned char* base = static_cast<unsigned char*>(jit->mp_code);
+		jit->m_neuronFunctions.assign(topology.m_neuronCount, nullptr);
+		for (uint n = 0; n < topology.m_neuronCount; n++) {
+			if (offsets[n + 1] > offsets[n]) { jit->m_neuronFunctions[n] = reinterpret_cast<NeuronFunction>(base + offsets[n]); }
+		}
+
+		if (JIT_PERF_MAP) { jit->registerWithPerf(offsets, topology.m_layoutHash); }
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		INFO("JIT-compiled the forward pass's {0} edges to {1} KB of x86-64 in {2} ms.", compiledEdges, a.m_code.size() / 1024, milliseconds);
+
+		return jit;
+#endif
+	}
+
+	ForwardJit::~ForwardJit()
+	{
+#ifdef FORWARD_JIT_SUPPORTED
+		if (mp_code != nullptr) { munmap(mp_code, m_codeSize); }
+#endif
+	}
+
+	void ForwardJit::registerWithPerf(const std::vector<size_t>& offsets, uint layoutHash) const
+	{
+#if defined(__linux__) && defined(FORWARD_JIT_SUPPORTED)
+		// Networks are built on many threads at once during population training.
+		static std::mutex s_perfMapMutex;
+		std::lock_guard<std::mutex> lock(s_perfMapMutex);
+
+		std::ofstream map("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::out | std::ios::app);
+		if (!map.is_open()) { return; }
+
+		// "start size name", in hex, one line per function.
+		map << std::hex;
+		const unsigned char* base = static_cast<const unsigned char*>(mp_code);
+		for (uint n = 0; n + 1 < offsets.size(); n++) {
+			if (offsets[n + 1] == offsets[n]) { continue; }
+			map << (size_t)(base + offsets[n]) << " " << (offsets[n + 1] - offsets[n]) << " novatheus_jit_" << layoutHash << "_neuron_" << std::dec << n << std::hex << "\n";
+		}
+#endif
+	}
+}
@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "core/idxfile.h"
+
+namespace Core {
+	namespace {
+		uint readBigEndian(const unsigned char* bytes)
+		{
+			return ((uint)bytes[0] << 24) | ((uint)bytes[1] << 16) | ((uint)bytes[2] << 8) | (uint)bytes[3];
+		}
+	}
+
+	bool IdxFile::open(const std::string& path, int expectedMagicNumber)
+	{
+		close();
+		if (!m_file.open(path)) { return false; }
+
+		const unsigned char* bytes = m_file.getData();
+		const size_t size = m_file.getSize();
+		if (size < 4 || (int)readBigEndian(bytes) != expectedMagicNumber) {
+			WARN("Magic Number read from '{0}' does not equal expected result {1}.", path, expectedMagicNumber);
+			close();
+			return false;
+		}
+
+		const uint dimensionCount = bytes[3];
+		const size_t headerSize = 4 + 4 * (size_t)dimensionCount;
+		if (dimensionCount == 0 || size < headerSize) {
+			WARN("IDX file '{0}' has a malformed header.", path);
+			close();
+			return false;
+		}
+
+		m_itemSize = 1;
+		for (uint d = 0; d < dimensionCount; d++) {
+			m_dimensions.push_back(readBigEndian(bytes + 4 + 4 * d));
+			if (d > 0) { m_itemSize *= m_dimensions.back(); }
+		}
+
+		if (size - headerSize < (size_t)m_dimensions[0] * m_itemSize) {
+			WARN("IDX file '{0}' is {1} bytes, too short for the {2} items of {3} bytes its header lists.", path, size, m_dimensions[0], m_itemSize);
+			close();
+			return false;
+		}
+
+		p_items = bytes + headerSize;
+		return true;
+	}
+
+	void IdxFile::close()
+	{
+		m_file.close();
+		m_dimensions.clear();
+		p_items = nullptr;
+		m_itemSize = 0;
+	}
+}
@@ -0,0 +1,308 @@
+#include "pch.h"
+#include "core/inferenceserver.h"
+#include "core/network.h"
+
+namespace Core {
+	namespace {
+		// Messages are little-endian, as is every x86 host, so values are copied as they are.
+		void appendWord(std::vector<char>& message, const void* word)
+		{
+			const char* bytes = static_cast<const char*>(word);
+			message.insert(message.end(), bytes, bytes + 4);
+		}
+	}
+
+	InferenceServer::InferenceServer(Network& network, unsigned short port) :
+		HasForwarder(network.getForwarder()),
+		r_network(network),
+		m_port(port)
+	{
+		m_pending.reserve(MINIBATCH_COUNT);
+		m_batchInputs.assign((size_t)MINIBATCH_COUNT * r_network.getInputCount(), 0.0f);
+		m_batchOutputs.assign((size_t)MINIBATCH_COUNT * r_network.getOutputCount(), 0.0f);
+		m_context = EvaluationContext(r_network);
+		m_latencies.reserve(SERVE_LATENCY_WINDOW);
+	}
+
+	bool InferenceServer::run()
+	{
+		if (m_listener.listen(m_port, sf::IpAddress::LocalHost) != sf::Socket::Done) {
+			WARN("id{0}: Could not listen on localhost:{1}.", getID(), m_port);
+			return false;
+		}
+		m_selector.add(m_listener);
+		calibrate();
+
+		INFO("id{0}: Serving network id{1} on localhost:{2}, {3} inputs to {4} outputs. Minibatches of up to {5}, waiting at most {6} us to fill. A client's stop message ends it.",
+			getID(), r_network.getID(), m_port, r_network.getInputCount(), r_network.getOutputCount(), MINIBATCH_COUNT, SERVE_BATCH_WINDOW_US);
+
+		const auto window = std::chrono::microseconds(SERVE_BATCH_WINDOW_US);
+		m_startTime = Clock::now();
+		auto lastStats = m_startTime;
+		unsigned long long servedAtLastStats = 0ull;
+
+		while (!m_stopping) {
+			// Wait for more requests, but no longer than the oldest pending one has left of its window. A zero timeout would
+			// wait forever.
+			long long timeout = 1000000ll;
+			if (!m_pending.empty()) {
+				auto left = std::chrono::duration_cast<std::chrono::microseconds>(m_pending.front().m_received + window - Clock::now()).count();
+				timeout = std::max<long long>(left, 1ll);
+			}
+			// The selector only wakes for reading, so answers still waiting on a client are retried every window.
+			for (auto& connection : m_connections) {
+				if (!connection->m_unsent.empty()) { timeout = std::min<long long>(timeout, SERVE_BATCH_WINDOW_US); }
+			}
+
+			if (m_selector.wait(sf::microseconds(timeout))) {
+				if (m_selector.isReady(m_listener)) { accept(); }
+				for (size_t i = 0; i < m_connections.size();) {
+					if (m_selector.isReady(*m_connections[i]->mp_socket) && !receive(*m_connections[i])) { close(i); }
+					else { i++; }
+				}
+			}
+
+			const auto now = Clock::now();
+			if (!m_pending.empty() && (m_pending.size() >= MINIBATCH_COUNT || now - m_pending.front().m_received >= window)) { runPending(); }
+
+			for (size_t i = 0; i < m_connections.size();) {
+				flush(*m_connections[i]);
+				if (m_connections[i]->m_dropping) { close(i); }
+				else { i++; }
+			}
+
+			if (now - lastStats >= std::chrono::seconds(SERVE_STATS_INTERVAL_S) && m_requestsServed > servedAtLastStats) {
+				logStats();
+				lastStats = now;
+				servedAtLastStats = m_requestsServed;
+			}
+		}
+
+		if (!m_pending.empty()) { runPending(); }
+		for (auto& connection : m_connections) { flush(*connection); } // Last chance; whatever the socket won't take is lost.
+		while (!m_connections.empty()) { close(m_connections.size() - 1); }
+		m_selector.clear();
+		m_listener.close();
+
+		INFO("id{0}: Stopped serving.", getID());
+		logStats();
+		return true;
+	}
+
+	void InferenceServer::calibrate()
+	{
+		// Best of a few, on zeros; the weights, not the inputs, decide the cost.
+		const uint repeats = 5u;
+		std::fill(m_batchInputs.begin(), m_batchInputs.end(), 0.0f);
+
+		float sampleTime = std::numeric_limits<float>::max(), batchTime = std::numeric_limits<float>::max();
+		for (uint r = 0; r < repeats; r++) {
+			auto start = Clock::now();
+			r_network.evaluate(Utils::Span<const float>(m_batchInputs.data(), r_network.getInputCount()), Utils::Span<float>(m_batchOutputs.data(), r_network.getOutputCount()), m_context);
+			auto middle = Clock::now();
+			r_network.runInputsBatch(m_batchInputs.data(), MINIBATCH_COUNT, m_batchOutputs.data());
+			auto end = Clock::now();
+
+			sampleTime = std::min(sampleTime, std::chrono::duration<float, std::micro>(middle - start).count());
+			batchTime = std::min(batchTime, std::chrono::duration<float, std::micro>(end - middle).count());
+		}
+
+		m_batchFrom = std::min((uint)std::ceil(batchTime / std::max(sampleTime, 1.0f)), MINIBATCH_COUNT);
+		INFO("id{0}: One sample takes {1} us, a minibatch {2} us. Requests are run one at a time below {3} to a minibatch.", getID(), sampleTime, batchTime, m_batchFrom);
+	}
+
+	void InferenceServer::accept()
+	{
+		auto connection = std::make_unique<Connection>();
+		connection->mp_socket = std::make_unique<sf::TcpSocket>();
+		if (m_listener.accept(*connection->mp_socket) != sf::Socket::Done) { return; }
+		connection->mp_socket->setBlocking(false);
+
+		m_selector.add(*connection->mp_socket);
+		m_connections.push_back(std::move(connection));
+		INFO("id{0}: Client connected. {1} connected.", getID(), m_connections.size());
+	}
+
+	bool InferenceServer::receive(Connection& connection)
+	{
+		char buffer[SERVE_RECEIVE_BYTES];
+		size_t received = 0;
+		sf::Socket::Status status = connection.mp_socket->receive(buffer, sizeof(buffer), received);
+		if (status == sf::Socket::Disconnected || status == sf::Socket::Error || connection.m_dropping) { return false; }
+
+		connection.m_received.insert(connection.m_received.end(), buffer, buffer + received);
+		return handleMessages(connection);
+	}
+
+	bool InferenceServer::handleMessages(Connection& connection)
+	{
+		const uint inputCount = r_network.getInputCount(), outputCount = r_network.getOutputCount();
+		const size_t inputBytes = (size_t)inputCount * sizeof(float);
+		std::vector<char>& bytes = connection.m_received;
+
+		// Answers go back in the order they were asked for, so one that would be answered straight away first waits for any of
+		// the connection's requests still pending.
+		auto runOwnPending = [&]() {
+			for (auto& request : m_pending) {
+				if (request.p_connection == &connection) {
+					runPending();
+					return;
+				}
+			}
+		};
+
+		size_t offset = 0;
+		while (bytes.size() - offset >= 4) {
+			uint type;
+			std::memcpy(&type, bytes.data() + offset, 4);
+
+			if (type == Infer) {
+				if (bytes.size() - offset - 4 < inputBytes) { break; }
+				if (m_pending.size() >= MINIBATCH_COUNT) { runPending(); }
+
+				std::memcpy(m_batchInputs.data() + m_pending.size() * inputCount, bytes.data() + offset + 4, inputBytes);
+				m_pending.push_back({ &connection, Clock::now() });
+				offset += 4 + inputBytes;
+			}
+			else if (type == Shape) {
+				runOwnPending();
+				std::vector<char> message;
+				appendWord(message, &inputCount);
+				appendWord(message, &outputCount);
+				send(connection, message);
+				offset += 4;
+			}
+			else if (type == Stats) {
+				runOwnPending();
+				auto percentiles = getLatencyPercentiles();
+				float seconds = std::chrono::duration<float>(Clock::now() - m_startTime).count();
+				float throughput = (seconds > 0.0f) ? (float)m_requestsServed / seconds : 0.0f;
+				uint served = (uint)m_requestsServed;
+
+				std::vector<char> message;
+				appendWord(message, &percentiles.first);
+				appendWord(message, &percentiles.second);
+				appendWord(message, &throughput);
+				appendWord(message, &served);
+				send(connection, message);
+				offset += 4;
+			}
+			else if (type == Stop) {
+				m_stopping = true;
+				offset += 4;
+			}
+			else {
+				WARN("id{0}: Unrecognised message type {1}. Closing the connection.", getID(), type);
+				return false;
+			}
+		}
+
+		bytes.erase(bytes.begin(), bytes.begin() + offset);
+		return true;
+	}
+
+	void InferenceServer::close(size_t index)
+	{
+		Connection* connection = m_connections[index].get();
+		for (auto& request : m_pending) {
+			if (request.p_connection == connection) { request.p_connection = nullptr; }
+		}
+
+		m_selector.remove(*connection->mp_socket);
+		connection->mp_socket->disconnect();
+		m_connections.erase(m_connections.begin() + index);
+		INFO("id{0}: Client disconnected. {1} connected.", getID(), m_connections.size());
+	}
+
+	void InferenceServer::runPending()
+	{
+		const uint inputCount = r_network.getInputCount(), outputCount = r_network.getOutputCount();
+		if (m_pending.size() >= m_batchFrom) {
+			r_network.runInputsBatch(m_batchInputs.data(), (uint)m_pending.size(), m_batchOutputs.data());
+			m_batchesRun++;
+			m_requestsBatched += m_pending.size();
+		}
+		else {
+			// Too few to pay for the batched pass, which costs nearly as much for one sample as for a full minibatch.
+			for (size_t r = 0; r < m_pending.size(); r++) {
+				if (m_pending[r].p_connection == nullptr) { continue; }
+				r_network.evaluate(Utils::Span<const float>(m_batchInputs.data() + r * inputCount, inputCount), Utils::Span<float>(m_batchOutputs.data() + r * outputCount, outputCount), m_context);
+			}
+		}
+
+		std::vector<char> message;
+		message.reserve(4 + (size_t)outputCount * sizeof(float));
+		for (size_t r = 0; r < m_pending.size(); r++) {
+			Request& request = m_pending[r];
+			if (request.p_connection == nullptr) { continue; }
+
+			const float* outputs = m_batchOutputs.data() + r * outputCount;
+			uint highest = (uint)(std::max_element(outputs, outputs + outputCount) - outputs);
+
+			message.clear();
+			appendWord(message, &highest);
+			for (uint o = 0; o < outputCount; o++) { appendWord(message, outputs + o); }
+			send(*request.p_connection, message);
+
+			float latency = std::chrono::duration<float, std::micro>(Clock::now() - request.m_received).count();
+			if (m_latencies.size() < SERVE_LATENCY_WINDOW) { m_latencies.push_back(latency); }
+			else { m_latencies[m_requestsServed % SERVE_LATENCY_WINDOW] = latency; }
+			m_requestsServed++;
+		}
+		m_pending.clear();
+	}
+
+	void InferenceServer::send(Connection& connection, const std::vector<char>& message)
+	{
+		if (connection.m_dropping) { return; }
+
+		connection.m_unsent.insert(connection.m_unsent.end(), message.begin(), message.end());
+		flush(connection);
+		if (connection.m_unsent.size() > SERVE_MAX_UNSENT_BYTES) {
+			WARN("id{0}: A client has left over {1} bytes of answers unread. Dropping it.", getID(), SERVE_MAX_UNSENT_BYTES);
+			connection.m_dropping = true;
+		}
+	}
+
+	void InferenceServer::flush(Connection& connection)
+	{
+		if (connection.m_unsent.empty()) { return; }
+
+		size_t sent = 0;
+		sf::Socket::Status status = connection.mp_socket->send(connection.m_unsent.data(), connection.m_unsent.size(), sent);
+		connection.m_unsent.erase(connection.m_unsent.begin(), connection.m_unsent.begin() + sent);
+
+		// Done, Partial and NotReady all leave the rest for later. A client that has gone is dropped.
+		if (status == sf::Socket::Disconnected || status == sf::Socket::Error) { connection.m_dropping = true; }
+	}
+
+	std::pair<float, float> InferenceServer::getLatencyPercentiles() const
+	{
+		if (m_latencies.empty()) { return std::make_pair(0.0f, 0.0f); }
+
+		std::vector<float> sorted(m_latencies);
+		auto percentile = [&sorted](float fraction) {
+			auto nth = sorted.begin() + (size_t)(fraction * (float)(sorted.size() - 1));
+			std::nth_element(sorted.begin(), nth, sorted.end());
+			return *nth;
+		};
+		float p50 = percentile(0.5f);
+		float p99 = percentile(0.99f);
+		return std::make_pair(p50, p99);
+	}
+
+	void InferenceServer::logStats()
+	{
+		auto percentiles = getLatencyPercentiles();
+		float seconds = std::chrono::duration<float>(Clock::now() - m_startTime).count();
+		INFO("id{0}: Served {1} requests, {2} of them in {3} minibatches, {4} per minibatch on average. Latency p50/p99: {5}/{6} us. Throughput: {7} requests/s.",
+			getID(),
+			m_requestsServed,
+			m_requestsBatched,
+			m_batchesRun,
+			(m_batchesRun > 0ull) ? (float)m_requestsBatched / (float)m_batchesRun : 0.0f,
+			percentiles.first,
+			percentiles.second,
+			(seconds > 0.0f) ? (float)m_requestsServed / seconds : 0.0f);
+	}
+}
@@ -0,0 +1,399 @@
+#include "pch.h"
+#include "core/kernels.h"
+#include "utils/cpu.h"
+
+#include <immintrin.h>
+
+// MSVC lets any function use any intrinsic; GCC and Clang need each function marked with the instruction sets it uses,
+// so that only the selected set's code ever runs on a machine without them.
+#ifdef _MSC_VER
+#define KERNEL_TARGET(isa)
+#else
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace Core {
+	namespace {
+		// Scalar reference.
+		void multiplyAddScalar(float* target, const float* source, float multiplier, uint count)
+		{
+			for (uint i = 0; i < count; i++) { target[i] += multiplier * source[i]; }
+		}
+
+		float dotScalar(const float* a, const float* b, uint count)
+		{
+			float sum = 0.0f;
+			for (uint i = 0; i < count; i++) { sum += a[i] * b[i]; }
+			return sum;
+		}
+
+		float gatherDotScalar(const float* values, const uint* indices, const float* weights, uint count)
+		{
+			float sum = 0.0f;
+			for (uint i = 0; i < count; i++) { sum += weights[i] * values[indices[i]]; }
+			return sum;
+		}
+
+		float gatherDotHalfScalar(const float* values, const uint* indices, const Utils::BFloat16* weights, uint count)
+		{
+			float sum = 0.0f;
+			for (uint i = 0; i < count; i++) { sum += weights[i].toFloat() * values[indices[i]]; }
+			return sum;
+		}
+
+		void multiplyAddBytesScalar(int* target, const unsigned char* source, int multiplier, uint count)
+		{
+			for (uint i = 0; i < count; i++) { target[i] += multiplier * (int)source[i]; }
+		}
+
+		void updateScalar(float* weights, float* gradients, float learningRate, float sampleCount, uint count)
+		{
+			for (uint i = 0; i < count; i++) {
+				weights[i] -= (gradients[i] * learningRate) / sampleCount;
+				gradients[i] = 0.0f;
+			}
+		}
+
+		// SSE2. Part of every x86-64 CPU, so this is the floor on 64-bit builds.
+		KERNEL_TARGET("sse2")
+		float horizontalSum(__m128 v)
+		{
+			__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+			__m128 sums = _mm_add_ps(v, shuffled);
+			shuffled = _mm_movehl_ps(shuffled, sums);
+			return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+		}
+
+		KERNEL_TARGET("sse2")
+		void multiplyAddSSE(float* target, const float* source, float multiplier, uint count)
+		{
+			const __m128 m = _mm_set1_ps(multiplier);
+			uint i = 0;
+			for (; i + 4 <= count; i += 4) {
+				_mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(m, _mm_loadu_ps(source + i))));
+			}
+			for (; i < count; i++) { target[i] += multiplier * source[i]; }
+		}
+
+		KERNEL_TARGET("sse2")
+		float dotSSE(const float* a, const float* b, uint count)
+		{
+			__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+			uint i = 0;
+			for (; i + 8 <= count; i += 8) {
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+			}
+			float sum = horizontalSum(_mm_add_ps(sum0, sum1));
+			for (; i < count; i++) { sum += a[i] * b[i]; }
+			return sum;
+		}
+
+		KERNEL_TARGET("sse2")
+		float gatherDotSSE(const float* values, const uint* indices, const float* weights, uint count)
+		{
+			// No gather instruction; four independent sums still hide the load latency.
+			__m128 sum = _mm_setzero_ps();
+			uint i = 0;
+			for (; i + 4 <= count; i += 4) {
+				__m128 v = _mm_set_ps(values[indices[i + 3]], values[indices[i + 2]], values[indices[i + 1]], values[indices[i]]);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(weights + i), v));
+			}
+			float total = horizontalSum(sum);
+			for (; i < count; i++) { total += weights[i] * values[indices[i]]; }
+			return total;
+		}
+
+		KERNEL_TARGET("sse2")
+		float gatherDotHalfSSE(const float* values, const uint* indices, const Utils::BFloat16* weights, uint count)
+		{
+			// Interleaving zeros below each bf16 widens it to a float.
+			__m128 sum = _mm_setzero_ps();
+			uint i = 0;
+			for (; i + 4 <= count; i += 4) {
+				__m128 w = _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i*)(weights + i))));
+				__m128 v = _mm_set_ps(values[indices[i + 3]], values[indices[i + 2]], values[indices[i + 1]], values[indices[i]]);
+				sum = _mm_add_ps(sum, _mm_mul_ps(w, v));
+			}
+			float total = horizontalSum(sum);
+			for (; i < count; i++) { total += weights[i].toFloat() * values[indices[i]]; }
+			return total;
+		}
+
+		KERNEL_TARGET("sse2")
+		void multiplyAddBytesSSE(int* target, const unsigned char* source, int multiplier, uint count)
+		{
+			// An int8 times a uint8 always fits in 16 bits, so multiply in 16 bits and only widen the products.
+			const __m128i m = _mm_set1_epi16((short)multiplier), zero = _mm_setzero_si128();
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m128i bytes = _mm_loadu_si128((const __m128i*)(source + i));
+				__m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(bytes, zero), m);
+				__m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(bytes, zero), m);
+				__m128i* t = (__m128i*)(target + i);
+				_mm_storeu_si128(t + 0, _mm_add_epi32(_mm_loadu_si128(t + 0), _mm_srai_epi32(_mm_unpacklo_epi16(low, low), 16)));
+				_mm_storeu_si128(t + 1, _mm_add_epi32(_mm_loadu_si128(t + 1), _mm_srai_epi32(_mm_unpackhi_epi16(low, low), 16)));
+				_mm_storeu_si128(t + 2, _mm_add_epi32(_mm_loadu_si128(t + 2), _mm_srai_epi32(_mm_unpacklo_epi16(high, high), 16)));
+				_mm_storeu_si128(t + 3, _mm_add_epi32(_mm_loadu_si128(t + 3), _mm_srai_epi32(_mm_unpackhi_epi16(high, high), 16)));
+			}
+			for (; i < count; i++) { target[i] += multiplier * (int)source[i]; }
+		}
+
+		KERNEL_TARGET("sse2")
+		void updateSSE(float* weights, float* gradients, float learningRate, float sampleCount, uint count)
+		{
+			const __m128 rate = _mm_set1_ps(learningRate), samples = _mm_set1_ps(sampleCount), zero = _mm_setzero_ps();
+			uint i = 0;
+			for (; i + 4 <= count; i += 4) {
+				__m128 step = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(gradients + i), rate), samples);
+				_mm_storeu_ps(weights + i, _mm_sub_ps(_mm_loadu_ps(weights + i), step));
+				_mm_storeu_ps(gradients + i, zero);
+			}
+			for (; i < count; i++) {
+				weights[i] -= (gradients[i] * learningRate) / sampleCount;
+				gradients[i] = 0.0f;
+			}
+		}
+
+		// AVX2 with FMA.
+		KERNEL_TARGET("avx2,fma")
+		float horizontalSum(__m256 v)
+		{
+			__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			__m128 shuffled = _mm_movehdup_ps(sum);
+			sum = _mm_add_ps(sum, shuffled);
+			shuffled = _mm_movehl_ps(shuffled, sum);
+			return _mm_cvtss_f32(_mm_add_ss(sum, shuffled));
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		void multiplyAddAVX2(float* target, const float* source, float multiplier, uint count)
+		{
+			const __m256 m = _mm256_set1_ps(multiplier);
+			uint i = 0;
+			for (; i + 8 <= count; i += 8) {
+				_mm256_storeu_ps(target + i, _mm256_fmadd_ps(m, _mm256_loadu_ps(source + i), _mm256_loadu_ps(target + i)));
+			}
+			for (; i < count; i++) { target[i] += multiplier * source[i]; }
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		float dotAVX2(const float* a, const float* b, uint count)
+		{
+			__m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+				sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+			}
+			for (; i + 8 <= count; i += 8) { sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0); }
+			float sum = horizontalSum(_mm256_add_ps(sum0, sum1));
+			for (; i < count; i++) { sum += a[i] * b[i]; }
+			return sum;
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		float gatherDotAVX2(const float* values, const uint* indices, const float* weights, uint count)
+		{
+			__m256 sum = _mm256_setzero_ps();
+			uint i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256i index = _mm256_loadu_si256((const __m256i*)(indices + i));
+				sum = _mm256_fmadd_ps(_mm256_loadu_ps(weights + i), _mm256_i32gather_ps(values, index, 4), sum);
+			}
+			float total = horizontalSum(sum);
+			for (; i < count; i++) { total += weights[i] * values[indices[i]]; }
+			return total;
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		float gatherDotHalfAVX2(const float* values, const uint* indices, const Utils::BFloat16* weights, uint count)
+		{
+			__m256 sum = _mm256_setzero_ps();
+			uint i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256i index = _mm256_loadu_si256((const __m256i*)(indices + i));
+				__m256 w = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(weights + i))), 16));
+				sum = _mm256_fmadd_ps(w, _mm256_i32gather_ps(values, index, 4), sum);
+			}
+			float total = horizontalSum(sum);
+			for (; i < count; i++) { total += weights[i].toFloat() * values[indices[i]]; }
+			return total;
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		void multiplyAddBytesAVX2(int* target, const unsigned char* source, int multiplier, uint count)
+		{
+			const __m256i m = _mm256_set1_epi16((short)multiplier);
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m256i products = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(source + i))), m);
+				__m256i* t = (__m256i*)(target + i);
+				_mm256_storeu_si256(t + 0, _mm256_add_epi32(_mm256_loadu_si256(t + 0), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(products))));
+				_mm256_storeu_si256(t + 1, _mm256_add_epi32(_mm256_loadu_si256(t + 1), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(products, 1))));
+			}
+			for (; i < count; i++) { target[i] += multiplier * (int)source[i]; }
+		}
+
+		KERNEL_TARGET("avx2,fma")
+		void updateAVX2(float* weights, float* gradients, float learningRate, float sampleCount, uint count)
+		{
+			// Kept as a multiply then a divide, not an FMA, so every level applies bit-identical updates.
+			const __m256 rate = _mm256_set1_ps(learningRate), samples = _mm256_set1_ps(sampleCount), zero = _mm256_setzero_ps();
+			uint i = 0;
+			for (; i + 8 <= count; i += 8) {
+				__m256 step = _mm256_div_ps(_mm256_mul_ps(_mm256_loadu_ps(gradients + i), rate), samples);
+				_mm256_storeu_ps(weights + i, _mm256_sub_ps(_mm256_loadu_ps(weights + i), step));
+				_mm256_storeu_ps(gradients + i, zero);
+			}
+			for (; i < count; i++) {
+				weights[i] -= (gradients[i] * learningRate) / sampleCount;
+				gradients[i] = 0.0f;
+			}
+		}
+
+		// AVX-512F. Tails use masked loads and stores rather than a scalar loop.
+		KERNEL_TARGET("avx512f")
+		__mmask16 tailMask(uint remaining) { return (__mmask16)((1u << remaining) - 1u); }
+
+		KERNEL_TARGET("avx512f")
+		void multiplyAddAVX512(float* target, const float* source, float multiplier, uint count)
+		{
+			const __m512 m = _mm512_set1_ps(multiplier);
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				_mm512_storeu_ps(target + i, _mm512_fmadd_ps(m, _mm512_loadu_ps(source + i), _mm512_loadu_ps(target + i)));
+			}
+			if (i < count) {
+				__mmask16 mask = tailMask(count - i);
+				__m512 t = _mm512_fmadd_ps(m, _mm512_maskz_loadu_ps(mask, source + i), _mm512_maskz_loadu_ps(mask, target + i));
+				_mm512_mask_storeu_ps(target + i, mask, t);
+			}
+		}
+
+		KERNEL_TARGET("avx512f")
+		float dotAVX512(const float* a, const float* b, uint count)
+		{
+			__m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+			uint i = 0;
+			for (; i + 32 <= count; i += 32) {
+				sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+				sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+			}
+			for (; i + 16 <= count; i += 16) { sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0); }
+			if (i < count) {
+				__mmask16 mask = tailMask(count - i);
+				sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), sum1);
+			}
+			return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+		}
+
+		KERNEL_TARGET("avx512f")
+		float gatherDotAVX512(const float* values, const uint* indices, const float* weights, uint count)
+		{
+			__m512 sum = _mm512_setzero_ps();
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512i index = _mm512_loadu_si512(indices + i);
+				sum = _mm512_fmadd_ps(_mm512_loadu_ps(weights + i), _mm512_i32gather_ps(index, values, 4), sum);
+			}
+			if (i < count) {
+				__mmask16 mask = tailMask(count - i);
+				__m512i index = _mm512_maskz_loadu_epi32(mask, indices + i);
+				__m512 v = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, index, values, 4);
+				sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, weights + i), v, sum);
+			}
+			return _mm512_reduce_add_ps(sum);
+		}
+
+		KERNEL_TARGET("avx512f")
+		__m512 widenHalf(__m256i half) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(half), 16)); }
+
+		KERNEL_TARGET("avx512f")
+		float gatherDotHalfAVX512(const float* values, const uint* indices, const Utils::BFloat16* weights, uint count)
+		{
+			__m512 sum = _mm512_setzero_ps();
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512i index = _mm512_loadu_si512(indices + i);
+				__m512 w = widenHalf(_mm256_loadu_si256((const __m256i*)(weights + i)));
+				sum = _mm512_fmadd_ps(w, _mm512_i32gather_ps(index, values, 4), sum);
+			}
+			float total = _mm512_reduce_add_ps(sum);
+			for (; i < count; i++) { total += weights[i].toFloat() * values[indices[i]]; } // No masked 16-bit loads without AVX-512BW.
+			return total;
+		}
+
+		KERNEL_TARGET("avx512f")
+		void multiplyAddBytesAVX512(int* target, const unsigned char* source, int multiplier, uint count)
+		{
+			// 16-bit multiplies need AVX-512BW, so widen straight to 32 bits.
+			const __m512i m = _mm512_set1_epi32(multiplier);
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512i products = _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(source + i))), m);
+				_mm512_storeu_si512(target + i, _mm512_add_epi32(_mm512_loadu_si512(target + i), products));
+			}
+			for (; i < count; i++) { target[i] += multiplier * (int)source[i]; }
+		}
+
+		KERNEL_TARGET("avx512f")
+		void updateAVX512(float* weights, float* gradients, float learningRate, float sampleCount, uint count)
+		{
+			const __m512 rate = _mm512_set1_ps(learningRate), samples = _mm512_set1_ps(sampleCount), zero = _mm512_setzero_ps();
+			uint i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m512 step = _mm512_div_ps(_mm512_mul_ps(_mm512_loadu_ps(gradients + i), rate), samples);
+				_mm512_storeu_ps(weights + i, _mm512_sub_ps(_mm512_loadu_ps(weights + i), step));
+				_mm512_storeu_ps(gradients + i, zero);
+			}
+			if (i < count) {
+				__mmask16 mask = tailMask(count - i);
+				__m512 step = _mm512_div_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(mask, gradients + i), rate), samples);
+				_mm512_mask_storeu_ps(weights + i, mask, _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, weights + i), step));
+				_mm512_mask_storeu_ps(gradients + i, mask, zero);
+			}
+		}
+
+		Kernels getTable(Kernels::Level level)
+		{
+			switch (level) {
+			case Kernels::Level::SSE:		return { &multiplyAddSSE, &dotSSE, &gatherDotSSE, &gatherDotHalfSSE, &multiplyAddBytesSSE, &updateSSE };
+			case Kernels::Level::AVX2:		return { &multiplyAddAVX2, &dotAVX2, &gatherDotAVX2, &gatherDotHalfAVX2, &multiplyAddBytesAVX2, &updateAVX2 };
+			case Kernels::Level::AVX512:	return { &multiplyAddAVX512, &dotAVX512, &gatherDotAVX512, &gatherDotHalfAVX512, &multiplyAddBytesAVX512, &updateAVX512 };
+			default:						return { &multiplyAddScalar, &dotScalar, &gatherDotScalar, &gatherDotHalfScalar, &multiplyAddBytesScalar, &updateScalar };
+			}
+		}
+	}
+
+	Kernels::Level Kernels::s_level = Kernels::getBestSupported();
+	Kernels Kernels::s_active = getTable(Kernels::s_level);
+
+	Kernels::Level Kernels::getBestSupported()
+	{
+		auto& cpu = Utils::CpuFeatures::get();
+		if (cpu.m_avx512f) { return Level::AVX512; }
+		if (cpu.m_avx2 && cpu.m_fma) { return Level::AVX2; }
+		if (cpu.m_sse2) { return Level::SSE; }
+		return Level::Scalar;
+	}
+
+	bool Kernels::select(Level level)
+	{
+		if (level > getBestSupported()) { return false; }
+
+		s_level = level;
+		s_active = getTable(level);
+		return true;
+	}
+
+	const char* Kernels::getName(Level level)
+	{
+		switch (level) {
+		case Level::SSE:	return "SSE2";
+		case Level::AVX2:	return "AVX2/FMA";
+		case Level::AVX512:	return "AVX-512";
+		default:			return "scalar";
+		}
+	}
+}
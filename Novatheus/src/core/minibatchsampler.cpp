@@ -0,0 +1,44 @@
+#include "pch.h"
+#include "core/minibatchsampler.h"
+
+namespace Core {
+	MinibatchSampler::MinibatchSampler(const Dataset& dataset, const std::array<bool, CROSSVAL_COUNT>& testSections, uint batchOffset) :
+		r_dataset(dataset)
+	{
+		const uint sectionSamples = r_dataset.getSectionSampleCount();
+		uint trainingSections = 0u;
+		for (uint s = 0; s < CROSSVAL_COUNT; s++) {
+			if (testSections[s]) { continue; }
+
+			trainingSections++;
+			for (uint i = 0; i < sectionSamples; i++) { m_order.push_back(s * sectionSamples + i); }
+		}
+		if (m_order.empty()) { return; }
+
+		if (SHUFFLE_TRAINING_SAMPLES) {
+			std::seed_seq seed { SAMPLER_SEED, batchOffset };
+			m_rng.seed(seed);
+			std::shuffle(m_order.begin(), m_order.end(), m_rng);
+		}
+		else {
+			// Where the old walk started: batchOffset's section among the training ones, and its batch within that.
+			const uint sectionBatches = sectionSamples / MINIBATCH_COUNT;
+			m_position = (((batchOffset / sectionBatches) % trainingSections) * sectionBatches + batchOffset % sectionBatches) * MINIBATCH_COUNT;
+		}
+	}
+
+	void MinibatchSampler::next(Batch& batch)
+	{
+		batch.m_activeInputCount = 0u;
+		for (auto& sample : batch.m_samples) {
+			sample = r_dataset.getSample(m_order[m_position++]);
+			batch.m_activeInputCount += sample.m_activeInputCount;
+
+			if (m_position == m_order.size()) {
+				m_position = 0u;
+				m_epoch++;
+				if (SHUFFLE_TRAINING_SAMPLES) { std::shuffle(m_order.begin(), m_order.end(), m_rng); }
+			}
+		}
+	}
+}
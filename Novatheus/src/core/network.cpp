@@ -1,62 +1,173 @@
 #include "pch.h"
 #include "core/network.h"
+#include "core/batchpipeline.h"
+#include "core/kernels.h"
+#include "utils/allocationcounter.h"
 
 namespace Core {
-	Network::Network(Genome * source, Squishifier* squishifier) :
+	Network::Network(Genome * source, std::shared_ptr<const NetworkTopology> topology, Squishifier* squishifier) :
 		HasForwarder(source->getForwarder()),
 		p_source(source),
-		m_inputCount(source->m_inputCount),
-		m_neuronCount(source->m_chromosomes.size()),
-		m_outputCount(source->m_outputCount),
-		m_valueBufferSize(source->m_inputCount + source->m_chromosomes.size()),
+		m_inputCount(topology->m_inputCount),
+		m_outputCount(topology->m_outputCount),
+		m_valueBufferSize(topology->m_valueBufferSize),
+		m_neuronCount(topology->m_neuronCount),
+		m_edgeCount(topology->m_edgeCount),
+		m_levelCount(topology->m_levelCount),
+		mp_topology(std::move(topology)),
+		m_weights(mp_topology->m_startingWeights),
+		m_biases(mp_topology->m_startingBiases),
 		m_startLRE(source->m_startLRExponent),
 		m_LRDelta(source->m_LRExponentDelta)
 	{
 		INFO("id{0}: Network generating from genome id{1}...", getID(), source->getID());
 		
 		mp_valueBuffer = new float[m_valueBufferSize];
-		m_neurons.reserve(m_neuronCount);
-
-		std::map<uint, uint> idsToIndices;
-		uint i = 0;
-
-		for (; i < m_inputCount; i++) { idsToIndices[i] = i; }
-
-		for (auto iter = source->m_chromosomes.begin(); iter != source->m_chromosomes.end(); ++iter) {
-			idsToIndices[iter->first] = i;
-			
-			m_neurons.emplace_back(this, iter->second, idsToIndices);
-
-			i++;
-		}
+		mp_batchValueBuffer = new float[(size_t)m_valueBufferSize * MINIBATCH_COUNT];
+
+		m_weightGradients.assign(m_edgeCount, 0.0f);
+		m_biasGradients.assign(m_neuronCount, 0.0f);
+		m_delAdelZ.assign(m_neuronCount, 0.0f);
+		m_delCdelA.assign(m_neuronCount, 0.0f);
+		m_batchDelAdelZ.assign((size_t)m_neuronCount * MINIBATCH_COUNT, 0.0f);
+		m_batchDelCdelA.assign((size_t)m_neuronCount * MINIBATCH_COUNT, 0.0f);
+		m_batchActiveOffsets.assign(m_inputCount + 1, 0u);
+		// Enough for the densest minibatch that takes the skip-zero path, so transposeActiveInputs never reallocates.
+		m_batchActiveSamples.reserve((size_t)(SPARSE_INPUT_MAX_DENSITY * (float)(m_inputCount * MINIBATCH_COUNT)) + 1u);
+		m_batchActiveValues.reserve(m_batchActiveSamples.capacity());
 
 		mp_squishifier = (squishifier != nullptr) ? squishifier : new FastSigmoid();
 
+		// Only known types can be devirtualised from here; anything else goes through the virtual interface.
+		if (dynamic_cast<FastSigmoid*>(mp_squishifier) != nullptr) { bindKernels<FastSigmoid>(); }
+		else { bindKernels<Squishifier>(); }
+
 		m_LRDeltaPerBatch = m_LRDelta / (float)STANDARD_TRAINING_BATCH_COUNT;
 
-		INFO("id{0}: Network generatiion complete.", getID());
+		INFO("id{0}: Network generatiion complete. {1} neurons across {2} levels.", getID(), m_neuronCount, m_levelCount);
+	}
+
+	template <class SquishifierType>
+	Network::Network(Genome * source, std::shared_ptr<const NetworkTopology> topology, SquishifierType* squishifier) :
+		Network(source, std::move(topology), static_cast<Squishifier*>(squishifier))
+	{
+		bindKernels<SquishifierType>();
 	}
 
 	Network::~Network()
 	{
 		delete[] mp_valueBuffer;
+		delete[] mp_batchValueBuffer;
 		delete mp_squishifier;
+		delete mp_threadPool;
+	}
+
+	void Network::writeWeightsToFile(std::ofstream & file)
+	{
+		Utils::FileOutHandler foh(file);
+
+		foh.writeItem(NETWORK_WEIGHTS_MAGIC);		// uint
+		foh.writeItem(NETWORK_WEIGHTS_VERSION);		// uint
+		foh.writeItem(mp_topology->m_layoutHash);	// uint
+		foh.writeItem(m_neuronCount);				// uint
+		foh.writeItem(m_edgeCount);					// uint
+
+		file.write(reinterpret_cast<const char*>(m_weights.data()), (std::streamsize)(m_weights.size() * sizeof(float)));
+		file.write(reinterpret_cast<const char*>(m_biases.data()), (std::streamsize)(m_biases.size() * sizeof(float)));
+	}
+
+	bool Network::readWeightsFromFile(std::ifstream & file)
+	{
+		Utils::FileInHandler fih(file);
+
+		uint magic = 0u, version = 0u, layoutHash = 0u, neuronCount = 0u, edgeCount = 0u;
+		fih.readItem(magic);		// uint
+		fih.readItem(version);		// uint
+		fih.readItem(layoutHash);	// uint
+		fih.readItem(neuronCount);	// uint
+		fih.readItem(edgeCount);	// uint
+
+		if (!file || magic != NETWORK_WEIGHTS_MAGIC || version != NETWORK_WEIGHTS_VERSION) {
+			WARN("id{0}: Not a weights file this version can read.", getID());
+			return false;
+		}
+		if (layoutHash != mp_topology->m_layoutHash || neuronCount != m_neuronCount || edgeCount != m_edgeCount) {
+			WARN("id{0}: Weights file was written for a different network layout ({1} neurons, {2} edges).", getID(), neuronCount, edgeCount);
+			return false;
+		}
+
+		std::vector<float> weights(m_edgeCount), biases(m_neuronCount);
+		file.read(reinterpret_cast<char*>(weights.data()), (std::streamsize)(weights.size() * sizeof(float)));
+		file.read(reinterpret_cast<char*>(biases.data()), (std::streamsize)(biases.size() * sizeof(float)));
+		if (!file) {
+			WARN("id{0}: Weights file is truncated.", getID());
+			return false;
+		}
+
+		m_weights.swap(weights);
+		m_biases.swap(biases);
+		setMixedPrecision(m_mixedPrecision); // Refreshes the bf16 copy, if there is one.
+		return true;
+	}
+
+	void Network::setMixedPrecision(bool mixedPrecision)
+	{
+		m_mixedPrecision = mixedPrecision;
+		m_hotWeights.clear();
+		if (m_mixedPrecision) {
+			m_hotWeights.reserve(m_edgeCount);
+			for (float w : m_weights) { m_hotWeights.push_back(Utils::BFloat16(w)); }
+		}
+	}
+
+	void Network::setUseJit(bool useJit)
+	{
+		m_useJit = useJit;
+		if (m_useJit && mp_forwardJit == nullptr) { mp_forwardJit = ForwardJit::compile(*mp_topology, MINIBATCH_COUNT, 1u, true); }
+	}
+
+	const ForwardJit* Network::getActiveJit() const
+	{
+		if (!m_useJit || m_mixedPrecision || Kernels::getSelected() < Kernels::Level::AVX2) { return nullptr; }
+		return mp_forwardJit.get();
+	}
+
+	void Network::setThreadCount(uint threadCount, bool splitSamples)
+	{
+		// Sample-parallel threads each need at least one aligned chunk of samples.
+		if (splitSamples) { threadCount = std::min(threadCount, (MINIBATCH_COUNT + SAMPLE_CHUNK_ALIGNMENT - 1) / SAMPLE_CHUNK_ALIGNMENT); }
+
+		delete mp_threadPool;
+		mp_threadPool = (threadCount > 1u) ? new Utils::ThreadPool(threadCount) : nullptr;
+		m_splitSamples = splitSamples && (mp_threadPool != nullptr);
+
+		uint slices = getSampleWorkerCount() - 1u;
+		m_workerWeightGradients.assign((size_t)slices * m_edgeCount, 0.0f);
+		m_workerBiasGradients.assign((size_t)slices * m_neuronCount, 0.0f);
 	}
 
 	std::vector<float> Network::runNetwork(std::vector<float>& inputs, bool prepForBackprop)
 	{
+		const NetworkTopology& topology = *mp_topology;
 		if (inputs.size() != m_inputCount) {
 			WARN("id{0}: Input vector of incorrect size {1} fed to network expecting size {2}", getID(), inputs.size(), m_inputCount);
 			while (inputs.size() < m_inputCount) { inputs.push_back(0.0f); }
 		}
 		
-		// Input values, suitably squished.
-		/*for (uint i = 0; i < m_inputCount; i++) {
-			mp_valueBuffer[i] = mp_squishifier->squish(inputs[i]);
-		}*/
+		// Input values, unsquished, as loadInputsBatch does.
+		std::copy(inputs.begin(), inputs.begin() + m_inputCount, mp_valueBuffer);
+
+		for (uint l = 0; l < m_levelCount; l++) {
+			const uint* neurons = topology.m_levelNeurons.data() + topology.m_levelOffsets[l];
+			auto calculateRange = [&](uint begin, uint end) {
+				for (uint k = begin; k < end; k++) {
+					mp_valueBuffer[m_inputCount + neurons[k]] = mp_calculate(*this, neurons[k], *mp_squishifier, prepForBackprop);
+				}
+			};
 
-		for (uint i = 0; i < m_neuronCount; i++) {
-			mp_valueBuffer[m_inputCount + i] = m_neurons[i].calculate(mp_squishifier, prepForBackprop);
+			uint count = topology.m_levelOffsets[l + 1] - topology.m_levelOffsets[l];
+			if (isWorthSplitting(l, 1u)) { mp_threadPool->parallelFor(count, calculateRange); }
+			else { calculateRange(0u, count); }
 		}
 
 		// Build a return a vector from outputs.
@@ -68,10 +179,261 @@ namespace Core {
 		return returnVals;
 	}
 
-	std::tuple<float, float, float>  Network::trainFromBatch(Batch& batch)
+	EvaluationContext::EvaluationContext(const Network& network) :
+		m_values(network.getValueBufferSize(), 0.0f)
+	{}
+
+	bool Network::evaluate(Utils::Span<const float> inputs, Utils::Span<float> outputs, EvaluationContext& context) const
+	{
+		if (inputs.size() != m_inputCount || outputs.size() != m_outputCount) {
+			WARN("id{0}: Evaluation spans of sizes {1} and {2} given to network expecting {3} inputs and {4} outputs.", getID(), inputs.size(), outputs.size(), m_inputCount, m_outputCount);
+			return false;
+		}
+
+		if (context.m_values.size() < m_valueBufferSize) { context.m_values.resize(m_valueBufferSize); }
+		float* values = context.m_values.data();
+		std::copy(inputs.begin(), inputs.end(), values);
+
+		// topology.m_levelNeurons is already in dependency order.
+		const uint* neurons = mp_topology->m_levelNeurons.data();
+		for (uint k = 0; k < m_neuronCount; k++) {
+			values[m_inputCount + neurons[k]] = mp_evaluate(*this, neurons[k], *mp_squishifier, values);
+		}
+
+		std::copy(values + (m_valueBufferSize - m_outputCount), values + m_valueBufferSize, outputs.begin());
+		return true;
+	}
+
+	void Network::runBatch(Batch& batch, bool prepForBackprop)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		m_batchIsSparse = m_useSparseInputs &&
+			(float)batch.m_activeInputCount <= SPARSE_INPUT_MAX_DENSITY * (float)(m_inputCount * MINIBATCH_COUNT);
+
+		if (m_splitSamples) {
+			const uint workers = getSampleWorkerCount();
+			auto workerRange = [&](uint begin, uint end) {
+				for (uint w = begin; w < end; w++) {
+					runSampleRange(batch, prepForBackprop, getSampleChunkBegin(workers, w), getSampleChunkBegin(workers, w + 1));
+				}
+			};
+			mp_threadPool->parallelFor(workers, workerRange);
+		}
+		else {
+			if (m_batchIsSparse) {
+				// Each sample only touches its own column, so samples split across threads without conflict.
+				auto sampleRange = [&](uint begin, uint end) { runSparseInputBlockBatch(batch, begin, end); };
+				if (mp_threadPool != nullptr && (unsigned long long)batch.m_activeInputCount * (topology.m_inputFanOutEdges.size() / std::max(m_inputCount, 1u)) >= PARALLEL_LEVEL_MIN_WORK) {
+					mp_threadPool->parallelFor(MINIBATCH_COUNT, sampleRange);
+				}
+				else { sampleRange(0u, MINIBATCH_COUNT); }
+			}
+			else {
+				loadInputsBatch(batch, 0u, MINIBATCH_COUNT);
+				runInputBlockBatch();
+			}
+
+			runLevelsBatch(prepForBackprop);
+		}
+
+		if (m_batchIsSparse && prepForBackprop) { transposeActiveInputs(batch); }
+	}
+
+	void Network::runInputsBatch(const float* inputs, uint sampleCount, float* outputs)
+	{
+		sampleCount = std::min(sampleCount, MINIBATCH_COUNT);
+		m_batchIsSparse = false;
+
+		for (uint i = 0; i < m_inputCount; i++) {
+			float* row = mp_batchValueBuffer + (size_t)i * MINIBATCH_COUNT;
+			for (uint s = 0; s < sampleCount; s++) { row[s] = inputs[(size_t)s * m_inputCount + i]; }
+		}
+
+		if (sampleCount == MINIBATCH_COUNT) {
+			runInputBlockBatch();
+			runLevelsBatch(false);
+		}
+		else {
+			// A partial minibatch only pays for the samples in it, on this thread.
+			const NetworkTopology& topology = *mp_topology;
+			for (uint t = 0, tileCount = (uint)topology.m_inputTileOffsets.size() - 1; t < tileCount; t++) {
+				Neuron::calculateInputTileBatch(*this, t, 0u, sampleCount);
+			}
+			for (uint k = 0; k < m_neuronCount; k++) {
+				mp_calculateBatch(*this, topology.m_levelNeurons[k], *mp_squishifier, false, 0u, sampleCount);
+			}
+		}
+
+		const float* outputRows = mp_batchValueBuffer + (size_t)(m_valueBufferSize - m_outputCount) * MINIBATCH_COUNT;
+		for (uint s = 0; s < sampleCount; s++) {
+			for (uint o = 0; o < m_outputCount; o++) { outputs[(size_t)s * m_outputCount + o] = outputRows[(size_t)o * MINIBATCH_COUNT + s]; }
+		}
+	}
+
+	void Network::runLevelsBatch(bool prepForBackprop)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		for (uint l = 0; l < m_levelCount; l++) {
+			const uint* neurons = topology.m_levelNeurons.data() + topology.m_levelOffsets[l];
+			auto calculateRange = [&](uint begin, uint end) {
+				for (uint k = begin; k < end; k++) { mp_calculateBatch(*this, neurons[k], *mp_squishifier, prepForBackprop, 0u, MINIBATCH_COUNT); }
+			};
+
+			uint count = topology.m_levelOffsets[l + 1] - topology.m_levelOffsets[l];
+			if (isWorthSplitting(l, MINIBATCH_COUNT)) { mp_threadPool->parallelFor(count, calculateRange); }
+			else { calculateRange(0u, count); }
+		}
+	}
+
+	void Network::runSampleRange(Batch& batch, bool prepForBackprop, uint sampleBegin, uint sampleEnd)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		if (m_batchIsSparse) { runSparseInputBlockBatch(batch, sampleBegin, sampleEnd); }
+		else {
+			loadInputsBatch(batch, sampleBegin, sampleEnd);
+			for (uint t = 0, tileCount = (uint)topology.m_inputTileOffsets.size() - 1; t < tileCount; t++) {
+				Neuron::calculateInputTileBatch(*this, t, sampleBegin, sampleEnd);
+			}
+		}
+
+		// topology.m_levelNeurons is already in dependency order.
+		for (uint k = 0; k < m_neuronCount; k++) {
+			mp_calculateBatch(*this, topology.m_levelNeurons[k], *mp_squishifier, prepForBackprop, sampleBegin, sampleEnd);
+		}
+	}
+
+	void Network::loadInputsBatch(Batch& batch, uint sampleBegin, uint sampleEnd)
+	{
+		// Decode and transpose the samples into [input * MINIBATCH_COUNT + sample].
+		const float* decode = Dataset::getPixelInputs();
+		for (uint s = sampleBegin; s < sampleEnd; s++) {
+			const unsigned char* pixels = batch.m_samples[s].p_pixels;
+			for (uint i = 0; i < m_inputCount; i++) { mp_batchValueBuffer[(size_t)i * MINIBATCH_COUNT + s] = decode[pixels[i]]; }
+		}
+	}
+
+	void Network::runInputBlockBatch()
+	{
+		const NetworkTopology& topology = *mp_topology;
+		auto inputTileRange = [&](uint begin, uint end) {
+			for (uint t = begin; t < end; t++) { Neuron::calculateInputTileBatch(*this, t); }
+		};
+
+		uint tileCount = (uint)topology.m_inputTileOffsets.size() - 1;
+		if (mp_threadPool != nullptr && (unsigned long long)topology.m_inputTileEdges.size() * MINIBATCH_COUNT >= PARALLEL_LEVEL_MIN_WORK) {
+			mp_threadPool->parallelFor(tileCount, inputTileRange);
+		}
+		else { inputTileRange(0u, tileCount); }
+	}
+
+	void Network::runSparseInputBlockBatch(Batch& batch, uint sampleBegin, uint sampleEnd)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		for (uint n : topology.m_inputNeurons) {
+			float* row = mp_batchValueBuffer + (size_t)(m_inputCount + n) * MINIBATCH_COUNT;
+			for (uint s = sampleBegin; s < sampleEnd; s++) { row[s] = 0.0f; }
+		}
+
+		for (uint s = sampleBegin; s < sampleEnd; s++) {
+			batch.m_samples[s].forEachActiveInput(m_inputCount, [&](uint input, float x) {
+				for (uint f = topology.m_inputFanOutOffsets[input]; f < topology.m_inputFanOutOffsets[input + 1]; f++) {
+					mp_batchValueBuffer[(size_t)(m_inputCount + topology.m_inputFanOutNeurons[f]) * MINIBATCH_COUNT + s] += getHotWeight(topology.m_inputFanOutEdges[f]) * x;
+				}
+			});
+		}
+	}
+
+	void Network::transposeActiveInputs(Batch& batch)
+	{
+		std::fill(m_batchActiveOffsets.begin(), m_batchActiveOffsets.end(), 0u);
+		for (auto& sample : batch.m_samples) {
+			sample.forEachActiveInput(m_inputCount, [this](uint input, float) { m_batchActiveOffsets[input + 1]++; });
+		}
+		for (uint i = 0; i < m_inputCount; i++) { m_batchActiveOffsets[i + 1] += m_batchActiveOffsets[i]; }
+
+		m_batchActiveSamples.resize(batch.m_activeInputCount);
+		m_batchActiveValues.resize(batch.m_activeInputCount);
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			batch.m_samples[s].forEachActiveInput(m_inputCount, [this, s](uint input, float x) {
+				uint slot = m_batchActiveOffsets[input]++;
+				m_batchActiveSamples[slot] = s;
+				m_batchActiveValues[slot] = x;
+			});
+		}
+		// The fill pass left each offset at the start of the next input; shift back.
+		for (uint i = m_inputCount; i > 0; i--) { m_batchActiveOffsets[i] = m_batchActiveOffsets[i - 1]; }
+		m_batchActiveOffsets[0] = 0u;
+	}
+
+	void Network::accumulateSparseInputGradients()
+	{
+		const NetworkTopology& topology = *mp_topology;
+		// Edges of different inputs are disjoint, so inputs split across threads without conflict.
+		auto inputRange = [&](uint begin, uint end) {
+			for (uint i = begin; i < end; i++) {
+				for (uint f = topology.m_inputFanOutOffsets[i]; f < topology.m_inputFanOutOffsets[i + 1]; f++) {
+					const float* delCdelZ = m_batchDelAdelZ.data() + (size_t)topology.m_inputFanOutNeurons[f] * MINIBATCH_COUNT;
+					float gradient = 0.0f;
+					for (uint a = m_batchActiveOffsets[i]; a < m_batchActiveOffsets[i + 1]; a++) {
+						gradient += m_batchActiveValues[a] * delCdelZ[m_batchActiveSamples[a]];
+					}
+					m_weightGradients[topology.m_inputFanOutEdges[f]] += gradient;
+				}
+			}
+		};
+
+		if (mp_threadPool != nullptr && (unsigned long long)m_batchActiveSamples.size() * (topology.m_inputFanOutEdges.size() / std::max(m_inputCount, 1u)) >= PARALLEL_LEVEL_MIN_WORK) {
+			mp_threadPool->parallelFor(m_inputCount, inputRange);
+		}
+		else { inputRange(0u, m_inputCount); }
+	}
+
+	void Network::backpropBatch()
 	{
-		std::lock_guard<std::mutex> lock(*(batch.mp_inUse));
+		const NetworkTopology& topology = *mp_topology;
+		if (m_splitSamples) {
+			const uint workers = getSampleWorkerCount();
+			auto workerRange = [&](uint begin, uint end) {
+				for (uint w = begin; w < end; w++) {
+					backpropSampleRange(w, getSampleChunkBegin(workers, w), getSampleChunkBegin(workers, w + 1));
+				}
+			};
+			mp_threadPool->parallelFor(workers, workerRange);
+		}
+		else {
+			// Every consumer of a neuron sits in a later level, so each level can gather from the ones already done.
+			for (uint l = m_levelCount; l-- > 0;) {
+				const uint* neurons = topology.m_levelNeurons.data() + topology.m_levelOffsets[l];
+				auto backpropRange = [&](uint begin, uint end) {
+					for (uint k = begin; k < end; k++) { Neuron::runBackpropBatch(*this, neurons[k], m_weightGradients.data(), m_biasGradients.data()); }
+				};
+
+				uint count = topology.m_levelOffsets[l + 1] - topology.m_levelOffsets[l];
+				if (isWorthSplitting(l, MINIBATCH_COUNT)) { mp_threadPool->parallelFor(count, backpropRange); }
+				else { backpropRange(0u, count); }
+			}
+		}
 
+		if (m_batchIsSparse) { accumulateSparseInputGradients(); }
+	}
+
+	void Network::backpropSampleRange(uint worker, uint sampleBegin, uint sampleEnd)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		float* weightGradients = m_weightGradients.data();
+		float* biasGradients = m_biasGradients.data();
+		if (worker > 0u) {
+			weightGradients = m_workerWeightGradients.data() + (size_t)(worker - 1u) * m_edgeCount;
+			biasGradients = m_workerBiasGradients.data() + (size_t)(worker - 1u) * m_neuronCount;
+		}
+
+		for (uint k = m_neuronCount; k-- > 0;) {
+			Neuron::runBackpropBatch(*this, topology.m_levelNeurons[k], weightGradients, biasGradients, sampleBegin, sampleEnd);
+		}
+	}
+
+	std::tuple<float, float, float>  Network::trainFromBatch(Batch& batch)
+	{
 		// CA == 'Correct Answer'
 		float batchAverageCost = 0.0f;
 		float batchCAAverageCost = 0.0f;
@@ -80,14 +442,11 @@ namespace Core {
 		float learningRate = m_startLRE + (m_trainedBatches * m_LRDeltaPerBatch);
 		learningRate = std::pow(2.0f, learningRate);
 
-		for (auto& s : batch.m_samples) {
-			// Per sample
-			for (uint i = 0; i < s.m_inputs.size(); i++) { mp_valueBuffer[i] = s.m_inputs[i]; }
+		runBatch(batch, true);
 
-			// Run forwards;
-			for (uint i = 0; i < m_neuronCount; i++) {
-				mp_valueBuffer[m_inputCount + i] = m_neurons[i].calculate(mp_squishifier, true);
-			}
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			// Per sample
+			auto& sample = batch.m_samples[s];
 
 			float cost = 0.0f;
 
@@ -95,31 +454,26 @@ namespace Core {
 			uint highestOutputIndex = 0u;
 			uint correctOutputIndex = 0u;
 
-			std::vector<float> outputs;
-			outputs.reserve(m_outputCount);
-
-			auto rIter = m_neurons.rbegin();
-			auto rIterO = s.m_outputs.rbegin();
 			for (uint i = 0; i < m_outputCount; i++) {
-				outputs.insert(outputs.begin(), mp_valueBuffer[m_valueBufferSize - (i + 1)]);
-				bool isCorrectOutput = (*rIterO > 0.5f);
+				uint neuron = m_neuronCount - (i + 1);
+				float output = mp_batchValueBuffer[(size_t)(m_valueBufferSize - (i + 1)) * MINIBATCH_COUNT + s];
+				float target = sample.getTarget(m_outputCount - (i + 1));
+				bool isCorrectOutput = (target > 0.5f);
 				
-				float diff = mp_valueBuffer[m_valueBufferSize - (i + 1)] - (*rIterO);
+				float diff = output - target;
 				float partialCost = diff * diff;
 
 				// Cost of the true output is multiplied by 5.
 				if (isCorrectOutput) {
-					rIter->setDelCdelA(10.0f * diff);
+					m_batchDelCdelA[(size_t)neuron * MINIBATCH_COUNT + s] = 10.0f * diff;
 					partialCost *= 5.0f;
 				}
-				else { rIter->setDelCdelA(2.0f * diff); }
-				
-				rIter->runBackprop();
+				else { m_batchDelCdelA[(size_t)neuron * MINIBATCH_COUNT + s] = 2.0f * diff; }
 
 				cost += partialCost;
 
-				if (mp_valueBuffer[m_valueBufferSize - (i + 1)] > highestOutputVal) {
-					highestOutputVal = mp_valueBuffer[m_valueBufferSize - (i + 1)];
+				if (output > highestOutputVal) {
+					highestOutputVal = output;
 					highestOutputIndex = m_outputCount - (i + 1);
 				}
 
@@ -127,37 +481,32 @@ namespace Core {
 					correctOutputIndex = m_outputCount - (i + 1);
 					batchCAAverageCost += partialCost;
 				}
-
-				++rIter;
-				++rIterO;
 			}
 
 			batchAverageCost += cost;
 
 			if (highestOutputIndex == correctOutputIndex) { CASamples++; }
-
-			for (; rIter != m_neurons.rend(); ++rIter) {
-				rIter->runBackprop();
-			}
 		}
 
-		for (auto iter = m_neurons.begin(); iter != m_neurons.end(); ++iter) {
-			iter->endBatch(learningRate, MINIBATCH_COUNT);
+		// Run backwards, for the whole minibatch at once.
+		backpropBatch();
+
+		auto endRange = [&](uint begin, uint end) {
+			for (uint n = begin; n < end; n++) { Neuron::endBatch(*this, n, learningRate, MINIBATCH_COUNT); }
+		};
+		if (mp_threadPool != nullptr && (unsigned long long)m_edgeCount * getSampleWorkerCount() >= PARALLEL_LEVEL_MIN_WORK) {
+			mp_threadPool->parallelFor(m_neuronCount, endRange);
 		}
+		else { endRange(0u, m_neuronCount); }
 
 		batchAverageCost /= (float)MINIBATCH_COUNT;
 
 		batchCAAverageCost /= (float)MINIBATCH_COUNT;
 		float caPercentage = (100.0f * (float)CASamples) / (float)MINIBATCH_COUNT;
 
-		m_costBuffer.push_back(batchAverageCost);
-		if (m_costBuffer.size() > 100) { m_costBuffer.pop_front(); }
-
-		m_CACostBuffer.push_back(batchCAAverageCost);
-		if (m_CACostBuffer.size() > 100) { m_CACostBuffer.pop_front(); }
-
-		m_accuracyBuffer.push_back(caPercentage);
-		if (m_accuracyBuffer.size() > 100) { m_accuracyBuffer.pop_front(); }
+		m_costBuffer.push(batchAverageCost);
+		m_CACostBuffer.push(batchCAAverageCost);
+		m_accuracyBuffer.push(caPercentage);
 
 		m_trainedBatches++;
 
@@ -166,21 +515,16 @@ namespace Core {
 
 	std::tuple<float, float, float> Network::testFromBatch(Batch& batch)
 	{
-		std::lock_guard<std::mutex> lock(*(batch.mp_inUse));
-
 		// CA == 'Correct Answer'
 		float batchAverageCost = 0.0f;
 		float batchCAAverageCost = 0.0f;
 		uint CASamples = 0u;
 
-		for (auto& s : batch.m_samples) {
-			// Per sample
-			for (uint i = 0; i < s.m_inputs.size(); i++) { mp_valueBuffer[i] = s.m_inputs[i]; }
+		runBatch(batch, false);
 
-			// Run forwards;
-			for (uint i = 0; i < m_neuronCount; i++) {
-				mp_valueBuffer[m_inputCount + i] = m_neurons[i].calculate(mp_squishifier, false);
-			}
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			// Per sample
+			auto& sample = batch.m_samples[s];
 
 			float cost = 0.0f;
 
@@ -188,12 +532,12 @@ namespace Core {
 			uint highestOutputIndex = 0u;
 			uint correctOutputIndex = 0u;
 
-			auto rIter = m_neurons.rbegin();
-			auto rIterO = s.m_outputs.rbegin();
 			for (uint i = 0; i < m_outputCount; i++) {
-				bool isCorrectOutput = (*rIterO > 0.5f);
+				float output = mp_batchValueBuffer[(size_t)(m_valueBufferSize - (i + 1)) * MINIBATCH_COUNT + s];
+				float target = sample.getTarget(m_outputCount - (i + 1));
+				bool isCorrectOutput = (target > 0.5f);
 
-				float diff = mp_valueBuffer[m_valueBufferSize - (i + 1)] - (*rIterO);
+				float diff = output - target;
 				float partialCost = diff * diff;
 
 				// Cost of the true output is multiplied by 5.
@@ -201,8 +545,8 @@ namespace Core {
 
 				cost += partialCost;
 
-				if (mp_valueBuffer[m_valueBufferSize - (i + 1)] > highestOutputVal) {
-					highestOutputVal = mp_valueBuffer[m_valueBufferSize - (i + 1)];
+				if (output > highestOutputVal) {
+					highestOutputVal = output;
 					highestOutputIndex = m_outputCount - (i + 1);
 				}
 
@@ -210,9 +554,6 @@ namespace Core {
 					correctOutputIndex = m_outputCount - (i + 1);
 					batchCAAverageCost += partialCost;
 				}
-
-				++rIter;
-				++rIterO;
 			}
 
 			batchAverageCost += cost;
@@ -229,94 +570,78 @@ namespace Core {
 
 	Metrics Network::trainFromDataset(Dataset* dataset, std::array<bool, CROSSVAL_COUNT> crossvalidationSections, uint batches, uint batchOffset, bool detailedOutput)
 	{
-		uint batchIndex = 0, section = 0, batch = 0;
-
-		// Offset management. Not sure it'll ever be used, but whatevs.
-		uint cvsSize = dataset->m_data[0].m_batches.size();
-
-		uint cvsOffset = batchOffset / cvsSize;
-		uint trCvsCount = 0;
-		for (auto c : crossvalidationSections) { if (!c) { ++trCvsCount; } }
-		cvsOffset = cvsOffset % trCvsCount;
-		for (; section < CROSSVAL_COUNT && cvsOffset > 0; ++section) { if (!crossvalidationSections[section]) { cvsOffset--; } }
-		batch = batchOffset % cvsSize;
+		BatchPipeline pipeline(*dataset, crossvalidationSections, batchOffset, batches);
+		const uint epochBatches = pipeline.getEpochSampleCount() / MINIBATCH_COUNT;
+		if (epochBatches == 0u) {
+			WARN("id{0}: No minibatches to train on outside the testing sections. Training skipped.", getID());
+			return Metrics();
+		}
 
-		// Section and Batch are now at the right offsets.
 		if (detailedOutput) {
 			float slr = m_startLRE + (m_trainedBatches * m_LRDeltaPerBatch);
 			slr = std::pow(2.0f, slr);
-			INFO("id{0}: Training network for {1} batches (starting offset Section {2}, Batch {3}), with learning rate {4}...", getID(), batches, section, batch, slr);
+			INFO("id{0}: Training network for {1} batches (starting offset {2}, {3} batches an epoch{4}), with learning rate {5}...",
+				getID(), batches, batchOffset, epochBatches, AUGMENT_TRAINING_SAMPLES ? ", augmented" : "", slr);
 		}
 
-		// Do actual training.
-		while (batchIndex < batches) {
-			for (; section < CROSSVAL_COUNT && batchIndex < batches; section++) {
-				if (!crossvalidationSections[section]) {
-					// Is a training section.
-					for (; batch < cvsSize && batchIndex < batches; batch++) {
-						auto output = trainFromBatch(dataset->m_data[section].m_batches[batch]);
-						batchIndex++;
-
-						if (detailedOutput) {
-							INFO("id{0}: Finished training on Section {1}, Batch {2} (count {3}). Cost/CACost/Accuracy: {4}/{5}/{6}%.", getID(), section, batch, batchIndex, std::get<0>(output), std::get<1>(output), std::get<2>(output));
-						}
-					}
-					batch = 0;
+		// Heap allocations made by training and testing past the first minibatch, which should be none: by this thread, the
+		// thread pool and the pipeline's producer alike. Counted in debug builds only.
+		size_t allocationsAfterWarmup = 0;
 
+		// Do actual training.
+		uint batchIndex = 0;
+		for (; batchIndex < batches; batchIndex++) {
+			size_t allocationsBefore = Utils::AllocationCounter::getCount();
+			BatchPipeline::Slot& slot = pipeline.acquire();
+			auto output = trainFromBatch(slot.m_batch);
+			const uint epoch = slot.m_epoch;
 #ifdef DEBUG
-					{
-						float slr = m_startLRE + (m_trainedBatches * m_LRDeltaPerBatch);
-						slr = std::pow(2.0f, slr);
-
-						float trainingBufferAverageCost = 0.0f;
-						float trainingBufferAverageCACost = 0.0f;
-						float trainingBufferAccuracy = 0.0f;
-
-						for (auto& c : m_costBuffer) { trainingBufferAverageCost += c; }
-						for (auto& c : m_CACostBuffer) { trainingBufferAverageCACost += c; }
-						for (auto& a : m_accuracyBuffer) { trainingBufferAccuracy += a; }
-
-						trainingBufferAverageCost /= m_costBuffer.size();
-						trainingBufferAverageCACost /= m_CACostBuffer.size();
-						trainingBufferAccuracy /= m_accuracyBuffer.size();
-
-						INFO("id{0}: Completed Section {1}. Approximate training Cost/CACost/Accuracy: {2}/{3}/{4}%. Learning rate is now {5}. Continuing...",
-							getID(),
-							section,
-							trainingBufferAverageCost,
-							trainingBufferAverageCACost,
-							trainingBufferAccuracy,
-							slr);
-					}
+			const bool endsEpoch = slot.m_endsEpoch;
 #endif // DEBUG
-				}
+			pipeline.release();
+			if (batchIndex > 0) { allocationsAfterWarmup += Utils::AllocationCounter::getCount() - allocationsBefore; }
+
+			if (detailedOutput) {
+				INFO("id{0}: Finished training on Batch {1} of Epoch {2}. Cost/CACost/Accuracy: {3}/{4}/{5}%.", getID(), batchIndex + 1, epoch, std::get<0>(output), std::get<1>(output), std::get<2>(output));
+			}
+
+#ifdef DEBUG
+			if (endsEpoch) {
+				float slr = m_startLRE + (m_trainedBatches * m_LRDeltaPerBatch);
+				slr = std::pow(2.0f, slr);
+
+				float trainingBufferAverageCost = m_costBuffer.getAverage();
+				float trainingBufferAverageCACost = m_CACostBuffer.getAverage();
+				float trainingBufferAccuracy = m_accuracyBuffer.getAverage();
+
+				INFO("id{0}: Completed Epoch {1}. Approximate training Cost/CACost/Accuracy: {2}/{3}/{4}%. Learning rate is now {5}. Continuing...",
+					getID(),
+					epoch,
+					trainingBufferAverageCost,
+					trainingBufferAverageCACost,
+					trainingBufferAccuracy,
+					slr);
 			}
-			section = 0;
+#endif // DEBUG
 		}
 		
 		// Testing and metrics.
-		if (detailedOutput) { INFO("id{0}: Running testing...", getID()); }
-		float trainingBufferAverageCost = 0.0f;
-		float trainingBufferAverageCACost = 0.0f;
-		float trainingBufferAccuracy = 0.0f;
+		if (detailedOutput) { INFO("id{0}: Waited {1} ms in all for minibatches to be prepared. Running testing...", getID(), pipeline.getWaitedMilliseconds()); }
+		float trainingBufferAverageCost = m_costBuffer.getAverage();
+		float trainingBufferAverageCACost = m_CACostBuffer.getAverage();
+		float trainingBufferAccuracy = m_accuracyBuffer.getAverage();
 		float testingBufferAverageCost = 0.0f;
 		float testingBufferAverageCACost = 0.0f;
 		float testingBufferAccuracy = 0.0f;
 
-		for (auto& c : m_costBuffer) { trainingBufferAverageCost += c; }
-		for (auto& c : m_CACostBuffer) { trainingBufferAverageCACost += c; }
-		for (auto& a : m_accuracyBuffer) { trainingBufferAccuracy += a; }
-
-		trainingBufferAverageCost /= m_costBuffer.size();
-		trainingBufferAverageCACost /= m_CACostBuffer.size();
-		trainingBufferAccuracy /= m_accuracyBuffer.size();
-
 		uint testedBatches = 0;
 		for (uint s = 0; s < CROSSVAL_COUNT; ++s ) {
 			if (crossvalidationSections[s]) {
 				// Is a testing section.
 				for (auto& b : dataset->m_data[s].m_batches) {
+					size_t allocationsBefore = Utils::AllocationCounter::getCount();
 					auto output = testFromBatch(b);
+					allocationsAfterWarmup += Utils::AllocationCounter::getCount() - allocationsBefore;
 
 					testingBufferAverageCost	+= std::get<0>(output);
 					testingBufferAverageCACost	+= std::get<1>(output);
@@ -326,10 +651,36 @@ namespace Core {
 			}
 		}
 
+		if (Utils::AllocationCounter::isEnabled()) {
+			if (allocationsAfterWarmup > 0) { WARN("id{0}: Training and testing made {1} heap allocations past the first minibatch, across all threads. They should make none.", getID(), allocationsAfterWarmup); }
+			else if (detailedOutput) { INFO("id{0}: Training and testing made no heap allocations past the first minibatch, on any thread.", getID()); }
+		}
+
 		testingBufferAverageCost	/= (float)testedBatches;
 		testingBufferAverageCACost	/= (float)testedBatches;
 		testingBufferAccuracy		/= (float)testedBatches;
 
+		// Mixed precision: test again on the fp32 master weights, to show what the narrower weights cost.
+		float fullPrecisionTestingAverageCost = 0.0f;
+		float fullPrecisionTestingAccuracy = 0.0f;
+		if (m_mixedPrecision) {
+			m_mixedPrecision = false;
+			for (uint s = 0; s < CROSSVAL_COUNT; ++s) {
+				if (crossvalidationSections[s]) {
+					for (auto& b : dataset->m_data[s].m_batches) {
+						auto output = testFromBatch(b);
+
+						fullPrecisionTestingAverageCost	+= std::get<0>(output);
+						fullPrecisionTestingAccuracy	+= std::get<2>(output);
+					}
+				}
+			}
+			m_mixedPrecision = true;
+
+			fullPrecisionTestingAverageCost	/= (float)testedBatches;
+			fullPrecisionTestingAccuracy	/= (float)testedBatches;
+		}
+
 		if (detailedOutput) {
 			INFO("id{0}: Completed training for {1} batches. Approximate final training Cost/CACost/Accuracy: {2}/{3}/{4}%. Final testing Cost/CACost/Accuracy: {5}/{6}/{7}% (tested over {8} samples).",
 				getID(),
@@ -341,8 +692,20 @@ namespace Core {
 				testingBufferAverageCACost,
 				testingBufferAccuracy,
 				testedBatches * MINIBATCH_COUNT);
+
+			if (m_mixedPrecision) {
+				INFO("id{0}: Mixed-precision testing Cost/Accuracy: {1}/{2}%, against {3}/{4}% on the fp32 master weights.",
+					getID(),
+					testingBufferAverageCost,
+					testingBufferAccuracy,
+					fullPrecisionTestingAverageCost,
+					fullPrecisionTestingAccuracy);
+			}
 		}
 
-		return Metrics(trainingBufferAverageCost, trainingBufferAverageCACost, trainingBufferAccuracy, testingBufferAverageCost, testingBufferAverageCACost, testingBufferAccuracy);
+		return Metrics(trainingBufferAverageCost, trainingBufferAverageCACost, trainingBufferAccuracy, testingBufferAverageCost, testingBufferAverageCACost, testingBufferAccuracy,
+			fullPrecisionTestingAverageCost, fullPrecisionTestingAccuracy);
 	}
+
+	template Network::Network(Genome * source, std::shared_ptr<const NetworkTopology> topology, FastSigmoid* squishifier);
 }
\ No newline at end of file
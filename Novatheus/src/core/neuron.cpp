@@ -1,68 +1,189 @@
 #include "pch.h"
 #include "core/neuron.h"
 #include "core/network.h"
+#include "core/kernels.h"
 
 namespace Core {
-	Neuron::Neuron(Network* parent, const Chromosome& chromosome, std::map<uint, uint>& idsToIndices) :
-		p_parent(parent),
-		m_bias(chromosome.m_startingBias)
+	template <class SquishifierType>
+	float Neuron::calculate(Network& network, uint index, const SquishifierType& squishifier, bool prepForBackprop)
 	{
-		m_weights.reserve(chromosome.m_startingWeights.size());
-		for (auto& w : chromosome.m_startingWeights) {
-			uint va = idsToIndices[w.first];
-			int na = va - parent->getInputCount();
-			
-			m_weights.emplace_back(va, na, w.second);
+		float output = getWeightedSum(network, index, network.mp_valueBuffer);
+
+		if (prepForBackprop) {
+			network.m_delAdelZ[index] = squishifier.getDerivative(output);
+			network.m_delCdelA[index] = 0.0f;
 		}
+		output = squishifier.squish(output);
+
+		return output;
+	}
+
+	template <class SquishifierType>
+	float Neuron::evaluate(const Network& network, uint index, const SquishifierType& squishifier, const float* values)
+	{
+		return squishifier.squish(getWeightedSum(network, index, values));
 	}
 
-	Neuron::~Neuron()
+	float Neuron::getWeightedSum(const Network& network, uint index, const float* values)
 	{
+		const NetworkTopology& topology = *network.mp_topology;
+		const uint* sources = topology.m_sourceIndices.data();
+
+		const uint begin = topology.m_rowOffsets[index];
+		const uint count = topology.m_rowOffsets[index + 1] - begin;
+		return network.m_biases[index] + (network.m_mixedPrecision ?
+			Kernels::get().mp_gatherDotHalf(values, sources + begin, network.m_hotWeights.data() + begin, count) :
+			Kernels::get().mp_gatherDot(values, sources + begin, network.m_weights.data() + begin, count));
 	}
 
-	float Neuron::calculate(Squishifier * squishifier, bool prepForBackprop)
+	void Neuron::calculateInputTileBatch(Network& network, uint tile, uint sampleBegin, uint sampleEnd)
 	{
-		float output = m_bias;
-		for (auto& w : m_weights) {
-			output += w.m_weight * p_parent->mp_valueBuffer[w.m_valueAddress];
+		const NetworkTopology& topology = *network.mp_topology;
+		float* values = network.mp_batchValueBuffer;
+		const uint* sources = topology.m_sourceIndices.data();
+		const uint inputCount = network.m_inputCount;
+
+		uint first = tile * INPUT_TILE_NEURONS;
+		uint last = std::min(first + INPUT_TILE_NEURONS, (uint)topology.m_inputNeurons.size());
+		for (uint k = first; k < last; k++) {
+			float* row = values + (size_t)(inputCount + topology.m_inputNeurons[k]) * MINIBATCH_COUNT;
+			for (uint s = sampleBegin; s < sampleEnd; s++) { row[s] = 0.0f; }
 		}
 
-		if (prepForBackprop) {
-			m_delAdelZ = squishifier->getDerivative(output);
-			m_delCdelA = 0.0f;
+		// Entries are sorted by input, so consecutive entries mostly reuse the same (cached) input row.
+		const Kernels& kernels = Kernels::get();
+		for (uint f = topology.m_inputTileOffsets[tile], end = topology.m_inputTileOffsets[tile + 1]; f < end; f++) {
+			const uint e = topology.m_inputTileEdges[f];
+			const float w = network.getHotWeight(e);
+			const float* source = values + (size_t)sources[e] * MINIBATCH_COUNT;
+			float* row = values + (size_t)(inputCount + topology.m_inputTileNeurons[f]) * MINIBATCH_COUNT;
+			kernels.mp_multiplyAdd(row + sampleBegin, source + sampleBegin, w, sampleEnd - sampleBegin);
 		}
-		output = squishifier->squish(output);
+	}
 
-		return output;
+	template <class SquishifierType>
+	void Neuron::calculateBatch(Network& network, uint index, const SquishifierType& squishifier, bool prepForBackprop, uint sampleBegin, uint sampleEnd)
+	{
+		const NetworkTopology& topology = *network.mp_topology;
+		const float* values = network.mp_batchValueBuffer;
+		const uint* sources = topology.m_sourceIndices.data();
+
+		// Weighted sums for every sample in the minibatch. Each weight is loaded once and streamed
+		// across the whole row of its source, rather than once per sample.
+		float z[MINIBATCH_COUNT];
+		float* output = network.mp_batchValueBuffer + (size_t)(network.m_inputCount + index) * MINIBATCH_COUNT;
+		const float bias = network.m_biases[index];
+		const uint split = topology.m_rowSplits[index];
+
+		// Input-reading edges were already summed into the output row by the input block.
+		if (split > topology.m_rowOffsets[index]) {
+			for (uint s = sampleBegin; s < sampleEnd; s++) { z[s] = bias + output[s]; }
+		}
+		else {
+			for (uint s = sampleBegin; s < sampleEnd; s++) { z[s] = bias; }
+		}
+
+		const ForwardJit* jit = network.getActiveJit();
+		if (jit != nullptr && sampleBegin == 0u && sampleEnd == MINIBATCH_COUNT) {
+			ForwardJit::NeuronFunction sum = jit->getNeuronFunction(index);
+			if (sum != nullptr) { sum(values, network.m_weights.data(), z); }
+		}
+		else {
+			const Kernels& kernels = Kernels::get();
+			for (uint e = split, end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+				const float* source = values + (size_t)sources[e] * MINIBATCH_COUNT;
+				kernels.mp_multiplyAdd(z + sampleBegin, source + sampleBegin, network.getHotWeight(e), sampleEnd - sampleBegin);
+			}
+		}
+
+		if (prepForBackprop) {
+			float* delAdelZ = network.m_batchDelAdelZ.data() + (size_t)index * MINIBATCH_COUNT;
+			float* delCdelA = network.m_batchDelCdelA.data() + (size_t)index * MINIBATCH_COUNT;
+			for (uint s = sampleBegin; s < sampleEnd; s++) {
+				delAdelZ[s] = squishifier.getDerivative(z[s]);
+				delCdelA[s] = 0.0f;
+				output[s] = squishifier.squish(z[s]);
+			}
+		}
+		else {
+			for (uint s = sampleBegin; s < sampleEnd; s++) { output[s] = squishifier.squish(z[s]); }
+		}
 	}
 
-	void Neuron::runBackprop()
+	void Neuron::runBackpropBatch(Network& network, uint index, float* weightGradients, float* biasGradients, uint sampleBegin, uint sampleEnd)
 	{
-		float delCdelZ = m_delAdelZ * m_delCdelA;
-		
+		const NetworkTopology& topology = *network.mp_topology;
+		const float* values = network.mp_batchValueBuffer;
+		const uint* sources = topology.m_sourceIndices.data();
+		const float* delCdelZs = network.m_batchDelAdelZ.data();
+
+		float* delCdelZ = network.m_batchDelAdelZ.data() + (size_t)index * MINIBATCH_COUNT; // Overwritten in place.
+		float* delCdelA = network.m_batchDelCdelA.data() + (size_t)index * MINIBATCH_COUNT;
+
+		// Pull from every consumer. They all sit in later levels, so their delCdelZ rows are already final.
+		const Kernels& kernels = Kernels::get();
+		const uint sampleCount = sampleEnd - sampleBegin;
+		for (uint f = topology.m_fanOutOffsets[index], end = topology.m_fanOutOffsets[index + 1]; f < end; f++) {
+			const float* consumer = delCdelZs + (size_t)topology.m_fanOutNeurons[f] * MINIBATCH_COUNT;
+			kernels.mp_multiplyAdd(delCdelA + sampleBegin, consumer + sampleBegin, network.getHotWeight(topology.m_fanOutEdges[f]), sampleCount);
+		}
+
+		float biasGradient = 0.0f;
+		for (uint s = sampleBegin; s < sampleEnd; s++) {
+			delCdelZ[s] *= delCdelA[s];
+			biasGradient += delCdelZ[s];
+		}
+
 		// Bias
-		m_biasCurrentBatchCombinedGradient += delCdelZ;
-
-		for (auto& w : m_weights) {
-			// Weight
-			w.addGradientForSample(p_parent->mp_valueBuffer[w.m_valueAddress] * delCdelZ);
-			
-			// Chained to earlier neuron.
-			if (!w.m_isInput) {
-				p_parent->m_neurons[w.m_neuronAddress].m_delCdelA += w.m_weight * delCdelZ;
-			}
+		biasGradients[index] += biasGradient;
+
+		// Weights. Input edges of a skip-zero minibatch are left to Network::accumulateSparseInputGradients.
+		uint first = network.m_batchIsSparse ? topology.m_rowSplits[index] : topology.m_rowOffsets[index];
+		for (uint e = first, end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+			const float* source = values + (size_t)sources[e] * MINIBATCH_COUNT;
+			weightGradients[e] += kernels.mp_dot(source + sampleBegin, delCdelZ + sampleBegin, sampleCount);
 		}
 	}
 
-	void Neuron::endBatch(float learningRate, uint totalSampleCountInBatch)
+	void Neuron::endBatch(Network& network, uint index, float learningRate, uint totalSampleCountInBatch)
 	{
+		const NetworkTopology& topology = *network.mp_topology;
+		const uint workerSlices = network.getSampleWorkerCount() - 1u;
+
 		// Bias;
-		m_bias -= (m_biasCurrentBatchCombinedGradient * learningRate) / (float)totalSampleCountInBatch;
-		m_biasCurrentBatchCombinedGradient = 0.0f;
+		float biasGradient = network.m_biasGradients[index];
+		for (uint w = 0; w < workerSlices; w++) {
+			float& slice = network.m_workerBiasGradients[(size_t)w * network.m_neuronCount + index];
+			biasGradient += slice;
+			slice = 0.0f;
+		}
+		network.m_biases[index] -= (biasGradient * learningRate) / (float)totalSampleCountInBatch;
+		network.m_biasGradients[index] = 0.0f;
 
 		// Weights
-		for (auto& w : m_weights) {
-			w.endBatch(learningRate, totalSampleCountInBatch);
+		float* weights = network.m_weights.data();
+		float* gradients = network.m_weightGradients.data();
+		for (uint w = 0; w < workerSlices; w++) {
+			float* slice = network.m_workerWeightGradients.data() + (size_t)w * network.m_edgeCount;
+			for (uint e = topology.m_rowOffsets[index], end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+				gradients[e] += slice[e];
+				slice[e] = 0.0f;
+			}
+		}
+		const uint begin = topology.m_rowOffsets[index], end = topology.m_rowOffsets[index + 1];
+		Kernels::get().mp_update(weights + begin, gradients + begin, learningRate, (float)totalSampleCountInBatch, end - begin);
+
+		// The fp32 weights are the master copy. Round the updated row back down for the next passes.
+		if (network.m_mixedPrecision) {
+			for (uint e = begin; e < end; e++) { network.m_hotWeights[e] = Utils::BFloat16(weights[e]); }
 		}
 	}
+
+	// Activation kernel instantiations. Add a line pair here for any new squishifier that should be resolved at compile time.
+	template float Neuron::calculate<Squishifier>(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop);
+	template float Neuron::evaluate<Squishifier>(const Network& network, uint index, const Squishifier& squishifier, const float* values);
+	template void Neuron::calculateBatch<Squishifier>(Network& network, uint index, const Squishifier& squishifier, bool prepForBackprop, uint sampleBegin, uint sampleEnd);
+	template float Neuron::calculate<FastSigmoid>(Network& network, uint index, const FastSigmoid& squishifier, bool prepForBackprop);
+	template float Neuron::evaluate<FastSigmoid>(const Network& network, uint index, const FastSigmoid& squishifier, const float* values);
+	template void Neuron::calculateBatch<FastSigmoid>(Network& network, uint index, const FastSigmoid& squishifier, bool prepForBackprop, uint sampleBegin, uint sampleEnd);
 }
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "core/quantizednetwork.h"
+#include "core/network.h"
+#include "core/kernels.h"
+
+namespace Core {
+	namespace {
+		// Values are never negative, so rounding half up is just truncation after adding a half.
+		inline unsigned char toByte(float scaled) { return (unsigned char)std::min(std::max(scaled + 0.5f, 0.0f), 255.0f); }
+
+		uint getHighestOutput(const float* outputs, uint outputCount, uint sample)
+		{
+			uint highest = 0u;
+			for (uint o = 1; o < outputCount; o++) {
+				if (outputs[(size_t)o * MINIBATCH_COUNT + sample] > outputs[(size_t)highest * MINIBATCH_COUNT + sample]) { highest = o; }
+			}
+			return highest;
+		}
+	}
+
+	QuantizedNetwork::QuantizedNetwork(Network& source, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& calibrationSections, uint calibrationBatches, Squishifier* squishifier) :
+		HasForwarder(source.getForwarder()),
+		mp_topology(source.getTopology()),
+		m_inputCount(mp_topology->m_inputCount),
+		m_outputCount(mp_topology->m_outputCount),
+		m_valueBufferSize(mp_topology->m_valueBufferSize),
+		m_neuronCount(mp_topology->m_neuronCount),
+		m_edgeCount(mp_topology->m_edgeCount),
+		m_biases(source.m_biases)
+	{
+		INFO("id{0}: Quantizing network id{1} to int8...", getID(), source.getID());
+
+		m_values.assign((size_t)m_valueBufferSize * MINIBATCH_COUNT, 0u);
+		m_outputs.assign((size_t)m_outputCount * MINIBATCH_COUNT, 0.0f);
+
+		calibrate(source, dataset, calibrationSections, calibrationBatches);
+		quantizeWeights(source);
+
+		mp_squishifier = (squishifier != nullptr) ? squishifier : source.mp_squishifier->clone();
+
+		// Only known types can be devirtualised from here; anything else goes through the virtual interface.
+		if (dynamic_cast<FastSigmoid*>(mp_squishifier) != nullptr) { mp_calculate = &QuantizedNetwork::calculate<FastSigmoid>; }
+		else { mp_calculate = &QuantizedNetwork::calculate<Squishifier>; }
+
+		INFO("id{0}: Quantization complete. Weights {1} KB -> {2} KB, values per minibatch {3} KB -> {4} KB.",
+			getID(),
+			((size_t)m_edgeCount * sizeof(float)) / 1024,
+			((size_t)m_edgeCount * sizeof(signed char)) / 1024,
+			((size_t)m_valueBufferSize * MINIBATCH_COUNT * sizeof(float)) / 1024,
+			((size_t)m_valueBufferSize * MINIBATCH_COUNT * sizeof(unsigned char)) / 1024);
+	}
+
+	QuantizedNetwork::~QuantizedNetwork()
+	{
+		delete mp_squishifier;
+	}
+
+	void QuantizedNetwork::calibrate(Network& source, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& calibrationSections, uint calibrationBatches)
+	{
+		// Largest value each row reaches. Inputs are read from the samples, as the source may have skipped loading them.
+		std::vector<float> maxima(m_valueBufferSize, 0.0f);
+		uint batches = 0u;
+		for (uint s = 0; s < CROSSVAL_COUNT && batches < calibrationBatches; s++) {
+			if (!calibrationSections[s]) { continue; }
+
+			for (auto& batch : dataset->m_data[s].m_batches) {
+				if (batches >= calibrationBatches) { break; }
+
+				source.runBatch(batch, false);
+
+				for (auto& sample : batch.m_samples) {
+					for (uint i = 0; i < m_inputCount; i++) { maxima[i] = std::max(maxima[i], sample.getInput(i)); }
+				}
+				for (uint r = m_inputCount; r < m_valueBufferSize; r++) {
+					const float* row = source.mp_batchValueBuffer + (size_t)r * MINIBATCH_COUNT;
+					for (uint i = 0; i < MINIBATCH_COUNT; i++) { maxima[r] = std::max(maxima[r], row[i]); }
+				}
+				batches++;
+			}
+		}
+
+		// Rows that never went above 0 still get a usable scale; they will simply store 0.
+		m_valueScales.resize(m_valueBufferSize);
+		m_inverseValueScales.resize(m_valueBufferSize);
+		for (uint r = 0; r < m_valueBufferSize; r++) {
+			m_valueScales[r] = ((maxima[r] > 0.0f) ? maxima[r] : 1.0f) / 255.0f;
+			m_inverseValueScales[r] = 1.0f / m_valueScales[r];
+		}
+
+		INFO("id{0}: Calibrated value scales over {1} minibatches.", getID(), batches);
+	}
+
+	void QuantizedNetwork::quantizeWeights(Network& source)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		m_weights.resize(m_edgeCount);
+		m_weightScales.resize(m_neuronCount);
+
+		// Fold each source's value scale into its weight, then quantize the row symmetrically.
+		std::vector<float> scaled;
+		for (uint n = 0; n < m_neuronCount; n++) {
+			const uint begin = topology.m_rowOffsets[n], end = topology.m_rowOffsets[n + 1];
+			scaled.clear();
+			float largest = 0.0f;
+			for (uint e = begin; e < end; e++) {
+				scaled.push_back(source.m_weights[e] * m_valueScales[topology.m_sourceIndices[e]]);
+				largest = std::max(largest, std::abs(scaled.back()));
+			}
+
+			m_weightScales[n] = ((largest > 0.0f) ? largest : 1.0f) / 127.0f;
+			for (uint e = begin; e < end; e++) {
+				m_weights[e] = (signed char)std::lround(scaled[e - begin] / m_weightScales[n]);
+			}
+		}
+	}
+
+	template <class SquishifierType>
+	void QuantizedNetwork::calculate(QuantizedNetwork& network, uint index, const Squishifier& squishifier)
+	{
+		const SquishifierType& s = static_cast<const SquishifierType&>(squishifier);
+		const NetworkTopology& topology = *network.mp_topology;
+		const uint* sources = topology.m_sourceIndices.data();
+		const unsigned char* values = network.m_values.data();
+
+		int sums[MINIBATCH_COUNT] = {};
+		const Kernels& kernels = Kernels::get();
+		for (uint e = topology.m_rowOffsets[index], end = topology.m_rowOffsets[index + 1]; e < end; e++) {
+			kernels.mp_multiplyAddBytes(sums, values + (size_t)sources[e] * MINIBATCH_COUNT, network.m_weights[e], MINIBATCH_COUNT);
+		}
+
+		const float scale = network.m_weightScales[index];
+		const float bias = network.m_biases[index];
+		const float inverse = network.m_inverseValueScales[network.m_inputCount + index];
+		unsigned char* output = network.m_values.data() + (size_t)(network.m_inputCount + index) * MINIBATCH_COUNT;
+
+		const uint firstOutput = network.m_neuronCount - network.m_outputCount;
+		if (index >= firstOutput) {
+			float* outputs = network.m_outputs.data() + (size_t)(index - firstOutput) * MINIBATCH_COUNT;
+			for (uint i = 0; i < MINIBATCH_COUNT; i++) {
+				outputs[i] = s.squish(bias + scale * (float)sums[i]);
+				output[i] = toByte(outputs[i] * inverse);
+			}
+		}
+		else {
+			for (uint i = 0; i < MINIBATCH_COUNT; i++) { output[i] = toByte(s.squish(bias + scale * (float)sums[i]) * inverse); }
+		}
+	}
+
+	void QuantizedNetwork::runBatch(Batch& batch)
+	{
+		const NetworkTopology& topology = *mp_topology;
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			auto& sample = batch.m_samples[s];
+			for (uint i = 0; i < m_inputCount; i++) { m_values[(size_t)i * MINIBATCH_COUNT + s] = toByte(sample.getInput(i) * m_inverseValueScales[i]); }
+		}
+
+		// topology.m_levelNeurons is already in dependency order.
+		for (uint k = 0; k < m_neuronCount; k++) { mp_calculate(*this, topology.m_levelNeurons[k], *mp_squishifier); }
+	}
+
+	std::tuple<float, float, float> QuantizedNetwork::testFromBatch(Batch& batch)
+	{
+		// CA == 'Correct Answer'
+		float batchAverageCost = 0.0f;
+		float batchCAAverageCost = 0.0f;
+		uint CASamples = 0u;
+
+		runBatch(batch);
+
+		for (uint s = 0; s < MINIBATCH_COUNT; s++) {
+			auto& sample = batch.m_samples[s];
+
+			float cost = 0.0f;
+			for (uint o = 0; o < m_outputCount; o++) {
+				float diff = m_outputs[(size_t)o * MINIBATCH_COUNT + s] - sample.getTarget(o);
+				float partialCost = diff * diff;
+
+				// Cost of the true output is multiplied by 5.
+				if (o == sample.m_label) {
+					partialCost *= 5.0f;
+					batchCAAverageCost += partialCost;
+				}
+				cost += partialCost;
+			}
+			batchAverageCost += cost;
+
+			uint highest = getHighestOutput(m_outputs.data(), m_outputCount, s);
+			if (highest == sample.m_label) { CASamples++; }
+		}
+
+		batchAverageCost /= (float)MINIBATCH_COUNT;
+		batchCAAverageCost /= (float)MINIBATCH_COUNT;
+		float caPercentage = (100.0f * (float)CASamples) / (float)MINIBATCH_COUNT;
+
+		return std::make_tuple(batchAverageCost, batchCAAverageCost, caPercentage);
+	}
+
+	void QuantizedNetwork::reportDrift(Network& reference, Dataset* dataset, const std::array<bool, CROSSVAL_COUNT>& testSections)
+	{
+		std::array<float, 3> referenceTotals {}, quantizedTotals {};
+		std::vector<float> referenceOutputs((size_t)m_outputCount * MINIBATCH_COUNT);
+		uint testedBatches = 0u, agreements = 0u;
+		double outputDrift = 0.0;
+
+		for (uint s = 0; s < CROSSVAL_COUNT; s++) {
+			if (!testSections[s]) { continue; }
+
+			for (auto& batch : dataset->m_data[s].m_batches) {
+				auto referenceResult = reference.testFromBatch(batch);
+				std::copy(reference.mp_batchValueBuffer + (size_t)(m_valueBufferSize - m_outputCount) * MINIBATCH_COUNT,
+					reference.mp_batchValueBuffer + (size_t)m_valueBufferSize * MINIBATCH_COUNT,
+					referenceOutputs.begin());
+
+				auto quantizedResult = testFromBatch(batch);
+
+				for (uint i = 0; i < MINIBATCH_COUNT; i++) {
+					if (getHighestOutput(referenceOutputs.data(), m_outputCount, i) == getHighestOutput(m_outputs.data(), m_outputCount, i)) { agreements++; }
+				}
+				for (size_t i = 0; i < m_outputs.size(); i++) { outputDrift += std::abs(m_outputs[i] - referenceOutputs[i]); }
+
+				referenceTotals[0] += std::get<0>(referenceResult);
+				referenceTotals[1] += std::get<1>(referenceResult);
+				referenceTotals[2] += std::get<2>(referenceResult);
+				quantizedTotals[0] += std::get<0>(quantizedResult);
+				quantizedTotals[1] += std::get<1>(quantizedResult);
+				quantizedTotals[2] += std::get<2>(quantizedResult);
+				testedBatches++;
+			}
+		}
+
+		if (testedBatches == 0u) {
+			WARN("id{0}: No test sections given. Nothing to compare.", getID());
+			return;
+		}
+
+		const uint samples = testedBatches * MINIBATCH_COUNT;
+		INFO("id{0}: int8 testing Cost/CACost/Accuracy: {1}/{2}/{3}%, against {4}/{5}/{6}% for the fp32 network (tested over {7} samples).",
+			getID(),
+			quantizedTotals[0] / (float)testedBatches,
+			quantizedTotals[1] / (float)testedBatches,
+			quantizedTotals[2] / (float)testedBatches,
+			referenceTotals[0] / (float)testedBatches,
+			referenceTotals[1] / (float)testedBatches,
+			referenceTotals[2] / (float)testedBatches,
+			samples);
+		INFO("id{0}: Predictions agree on {1}% of samples. Mean absolute output drift: {2}.",
+			getID(),
+			(100.0f * (float)agreements) / (float)samples,
+			(float)(outputDrift / ((double)samples * m_outputCount)));
+	}
+}
@@ -0,0 +1,292 @@
+#include "pch.h"
+#include "core/topology.h"
+#include "core/genome.h"
+
+namespace Core {
+	NetworkTopology::NetworkTopology(Genome * source, bool reorderForLocality) :
+		m_inputCount(source->m_inputCount),
+		m_outputCount(source->m_outputCount),
+		m_neuronCount((uint)source->m_chromosomes.size()),
+		m_valueBufferSize(source->m_inputCount + (uint)source->m_chromosomes.size())
+	{
+		std::map<uint, uint> idsToIndices;
+		uint i = 0;
+
+		for (; i < m_inputCount; i++) { idsToIndices[i] = i; }
+
+		m_edgeCount = 0;
+		for (auto& c : source->m_chromosomes) { m_edgeCount += (uint)c.second.m_startingWeights.size(); }
+
+		m_rowOffsets.reserve(m_neuronCount + 1);
+		m_sourceIndices.reserve(m_edgeCount);
+		m_startingWeights.reserve(m_edgeCount);
+		m_startingBiases.reserve(m_neuronCount);
+
+		m_rowOffsets.push_back(0u);
+		for (auto iter = source->m_chromosomes.begin(); iter != source->m_chromosomes.end(); ++iter) {
+			idsToIndices[iter->first] = i;
+
+			for (auto& w : iter->second.m_startingWeights) {
+				m_sourceIndices.push_back(idsToIndices[w.first]);
+				m_startingWeights.push_back(w.second);
+			}
+			m_rowOffsets.push_back((uint)m_sourceIndices.size());
+			m_startingBiases.push_back(iter->second.m_startingBias);
+
+			i++;
+		}
+
+		if (reorderForLocality) { reorderNeurons(); }
+
+		buildInputBlock();
+		buildFanOut();
+		buildLevels();
+
+		m_layoutHash = 2166136261u;
+		auto hash = [this](uint value) {
+			for (uint b = 0; b < 4; b++) { m_layoutHash = (m_layoutHash ^ ((value >> (b * 8)) & 0xFFu)) * 16777619u; }
+		};
+		for (uint offset : m_rowOffsets) { hash(offset); }
+		for (uint source : m_sourceIndices) { hash(source); }
+	}
+
+	void NetworkTopology::buildInputBlock()
+	{
+		// Each row's input edges come first, in ascending order; its neuron edges follow in either direction, as
+		// reorderNeurons walks every other row downwards. Only the split between the two is relied on here.
+		m_rowSplits.resize(m_neuronCount);
+		m_inputNeurons.clear();
+		for (uint n = 0; n < m_neuronCount; n++) {
+			uint e = m_rowOffsets[n];
+			while (e < m_rowOffsets[n + 1] && m_sourceIndices[e] < m_inputCount) { e++; }
+			m_rowSplits[n] = e;
+
+			if (e > m_rowOffsets[n]) { m_inputNeurons.push_back(n); }
+		}
+
+		uint tileCount = ((uint)m_inputNeurons.size() + INPUT_TILE_NEURONS - 1) / INPUT_TILE_NEURONS;
+		m_inputTileOffsets.assign(1, 0u);
+		m_inputTileOffsets.reserve(tileCount + 1);
+		m_inputTileEdges.clear();
+		m_inputTileNeurons.clear();
+
+		std::vector<std::pair<uint, uint>> entries; // (edge, neuron)
+		for (uint t = 0; t < tileCount; t++) {
+			entries.clear();
+			uint last = std::min((t + 1) * INPUT_TILE_NEURONS, (uint)m_inputNeurons.size());
+			for (uint k = t * INPUT_TILE_NEURONS; k < last; k++) {
+				uint n = m_inputNeurons[k];
+				for (uint e = m_rowOffsets[n]; e < m_rowSplits[n]; e++) { entries.emplace_back(e, n); }
+			}
+
+			std::stable_sort(entries.begin(), entries.end(), [this](const std::pair<uint, uint>& a, const std::pair<uint, uint>& b) {
+				return m_sourceIndices[a.first] < m_sourceIndices[b.first];
+			});
+
+			for (auto& entry : entries) {
+				m_inputTileEdges.push_back(entry.first);
+				m_inputTileNeurons.push_back(entry.second);
+			}
+			m_inputTileOffsets.push_back((uint)m_inputTileEdges.size());
+		}
+
+		// Per-input fan-out, for the skip-zero path.
+		m_inputFanOutOffsets.assign(m_inputCount + 1, 0u);
+		for (uint n = 0; n < m_neuronCount; n++) {
+			for (uint e = m_rowOffsets[n]; e < m_rowSplits[n]; e++) { m_inputFanOutOffsets[m_sourceIndices[e] + 1]++; }
+		}
+		for (uint i = 0; i < m_inputCount; i++) { m_inputFanOutOffsets[i + 1] += m_inputFanOutOffsets[i]; }
+
+		std::vector<uint> cursors(m_inputFanOutOffsets.begin(), m_inputFanOutOffsets.end() - 1);
+		m_inputFanOutEdges.resize(m_inputFanOutOffsets.back());
+		m_inputFanOutNeurons.resize(m_inputFanOutOffsets.back());
+		for (uint n = 0; n < m_neuronCount; n++) {
+			for (uint e = m_rowOffsets[n]; e < m_rowSplits[n]; e++) {
+				uint slot = cursors[m_sourceIndices[e]]++;
+				m_inputFanOutEdges[slot] = e;
+				m_inputFanOutNeurons[slot] = n;
+			}
+		}
+	}
+
+	void NetworkTopology::buildFanOut()
+	{
+		// Counting-sort transpose of the CSR edges. Kept in sync with the rows by construction, unlike Chromosome::m_references,
+		// and edges end up in ascending consumer order within each neuron's fan-out.
+		m_fanOutOffsets.assign(m_neuronCount + 1, 0u);
+		for (uint e = 0; e < m_edgeCount; e++) {
+			if (m_sourceIndices[e] >= m_inputCount) { m_fanOutOffsets[m_sourceIndices[e] - m_inputCount + 1]++; }
+		}
+		for (uint n = 0; n < m_neuronCount; n++) { m_fanOutOffsets[n + 1] += m_fanOutOffsets[n]; }
+
+		std::vector<uint> cursors(m_fanOutOffsets.begin(), m_fanOutOffsets.end() - 1);
+		m_fanOutEdges.resize(m_fanOutOffsets.back());
+		m_fanOutNeurons.resize(m_fanOutOffsets.back());
+		for (uint n = 0; n < m_neuronCount; n++) {
+			for (uint e = m_rowOffsets[n]; e < m_rowOffsets[n + 1]; e++) {
+				if (m_sourceIndices[e] < m_inputCount) { continue; }
+
+				uint slot = cursors[m_sourceIndices[e] - m_inputCount]++;
+				m_fanOutEdges[slot] = e;
+				m_fanOutNeurons[slot] = n;
+			}
+		}
+	}
+
+	std::vector<uint> NetworkTopology::getNeuronLevels() const
+	{
+		// IDs only ever reference lower IDs, so index order is already topological.
+		std::vector<uint> levels(m_neuronCount, 0u);
+		for (uint n = 0; n < m_neuronCount; n++) {
+			uint level = 0u;
+			for (uint e = m_rowOffsets[n]; e < m_rowOffsets[n + 1]; e++) {
+				if (m_sourceIndices[e] >= m_inputCount) { level = std::max(level, levels[m_sourceIndices[e] - m_inputCount] + 1u); }
+			}
+			levels[n] = level;
+		}
+		return levels;
+	}
+
+	std::pair<uint, float> NetworkTopology::getGatherLocality(const std::vector<uint>& levels) const
+	{
+		// Input block: each tile streams every distinct input it reads once (see buildInputBlock).
+		std::vector<uint> lastTile(m_inputCount, 0u); // 1-based tile number, so 0 means never.
+		uint inputNeurons = 0u, inputRows = 0u;
+		for (uint n = 0; n < m_neuronCount; n++) {
+			const uint tile = inputNeurons / INPUT_TILE_NEURONS + 1u;
+			uint e = m_rowOffsets[n];
+			for (; e < m_rowOffsets[n + 1] && m_sourceIndices[e] < m_inputCount; e++) {
+				if (lastTile[m_sourceIndices[e]] != tile) {
+					lastTile[m_sourceIndices[e]] = tile;
+					inputRows++;
+				}
+			}
+			if (e > m_rowOffsets[n]) { inputNeurons++; }
+		}
+
+		// Neuron-to-neuron gathers, walked in evaluation order (by level, then index).
+		std::vector<uint> order(m_neuronCount);
+		for (uint n = 0; n < m_neuronCount; n++) { order[n] = n; }
+		std::stable_sort(order.begin(), order.end(), [&levels](uint a, uint b) { return levels[a] < levels[b]; });
+
+		unsigned long long totalJump = 0ull;
+		uint gathers = 0u, previous = m_inputCount;
+		for (uint n : order) {
+			for (uint e = m_rowOffsets[n]; e < m_rowOffsets[n + 1]; e++) {
+				const uint source = m_sourceIndices[e];
+				if (source < m_inputCount) { continue; }
+
+				totalJump += (source > previous) ? source - previous : previous - source;
+				previous = source;
+				gathers++;
+			}
+		}
+
+		return std::make_pair(inputRows, (gathers > 0u) ? (float)totalJump / (float)gathers : 0.0f);
+	}
+
+	void NetworkTopology::reorderNeurons()
+	{
+		std::vector<uint> levels = getNeuronLevels();
+		auto before = getGatherLocality(levels);
+
+		// Outputs are read from the back of the value buffer, and nothing reads them, so they stay last and in order.
+		const uint firstOutput = m_neuronCount - m_outputCount;
+		uint levelCount = 0u;
+		for (uint n = 0; n < firstOutput; n++) { levelCount = std::max(levelCount, levels[n] + 1u); }
+
+		std::vector<std::vector<uint>> levelGroups(levelCount);
+		for (uint n = 0; n < firstOutput; n++) { levelGroups[levels[n]].push_back(n); }
+
+		// Level by level, so every neuron is placed after all of its sources and index order stays topological. Within a level,
+		// neurons are sorted by the mean (new) position of their sources, pulling together neurons that read the same region
+		// of the value buffer.
+		std::vector<uint> newIndices(m_neuronCount);
+		std::vector<uint> order;
+		order.reserve(m_neuronCount);
+		std::vector<std::pair<float, uint>> keyed;
+		auto mapSource = [&](uint s) { return (s < m_inputCount) ? s : m_inputCount + newIndices[s - m_inputCount]; };
+
+		for (auto& group : levelGroups) {
+			keyed.clear();
+			for (uint n : group) {
+				float sum = 0.0f;
+				for (uint e = m_rowOffsets[n]; e < m_rowOffsets[n + 1]; e++) { sum += (float)mapSource(m_sourceIndices[e]); }
+				uint count = m_rowOffsets[n + 1] - m_rowOffsets[n];
+				keyed.emplace_back((count > 0u) ? sum / (float)count : 0.0f, n);
+			}
+			std::stable_sort(keyed.begin(), keyed.end(), [](const std::pair<float, uint>& a, const std::pair<float, uint>& b) { return a.first < b.first; });
+
+			for (auto& k : keyed) {
+				newIndices[k.second] = (uint)order.size();
+				order.push_back(k.second);
+			}
+		}
+		for (uint n = firstOutput; n < m_neuronCount; n++) {
+			newIndices[n] = (uint)order.size();
+			order.push_back(n);
+		}
+
+		// Rebuild the rows in the new order. Sources are re-sorted within each row so input edges still come first, but every
+		// other row walks its neuron sources downwards: a row ends on its most recent (and most likely cached) sources, and
+		// the next row then starts there rather than jumping back to the oldest.
+		NetworkTopology reordered(*this);
+		reordered.m_rowOffsets.clear();
+		reordered.m_sourceIndices.clear();
+		reordered.m_startingWeights.clear();
+		reordered.m_startingBiases.clear();
+
+		std::vector<std::pair<uint, float>> row;
+		reordered.m_rowOffsets.push_back(0u);
+		for (uint n : order) {
+			row.clear();
+			for (uint e = m_rowOffsets[n]; e < m_rowOffsets[n + 1]; e++) { row.emplace_back(mapSource(m_sourceIndices[e]), m_startingWeights[e]); }
+			std::sort(row.begin(), row.end(), [](const std::pair<uint, float>& a, const std::pair<uint, float>& b) { return a.first < b.first; });
+			if ((newIndices[n] % 2u) == 1u) {
+				auto firstNeuron = std::find_if(row.begin(), row.end(), [this](const std::pair<uint, float>& edge) { return edge.first >= m_inputCount; });
+				std::reverse(firstNeuron, row.end());
+			}
+
+			for (auto& edge : row) {
+				reordered.m_sourceIndices.push_back(edge.first);
+				reordered.m_startingWeights.push_back(edge.second);
+			}
+			reordered.m_rowOffsets.push_back((uint)reordered.m_sourceIndices.size());
+			reordered.m_startingBiases.push_back(m_startingBiases[n]);
+		}
+
+		// Only keep the new order if it actually helps.
+		auto after = reordered.getGatherLocality(reordered.getNeuronLevels());
+		if (after.second >= before.second) {
+			INFO("Kept genome order for {0} neurons, as reordering would not improve locality (mean jump between consecutive neuron gathers: {1} -> {2} rows).",
+				m_neuronCount, before.second, after.second);
+			return;
+		}
+
+		m_rowOffsets.swap(reordered.m_rowOffsets);
+		m_sourceIndices.swap(reordered.m_sourceIndices);
+		m_startingWeights.swap(reordered.m_startingWeights);
+		m_startingBiases.swap(reordered.m_startingBiases);
+		INFO("Reordered {0} neurons for locality. Mean jump between consecutive neuron gathers: {1} -> {2} rows. Input rows streamed by the input block: {3} -> {4}.",
+			m_neuronCount, before.second, after.second, before.first, after.first);
+	}
+
+	void NetworkTopology::buildLevels()
+	{
+		std::vector<uint> levels = getNeuronLevels();
+		m_levelCount = 0u;
+		for (uint n = 0; n < m_neuronCount; n++) { m_levelCount = std::max(m_levelCount, levels[n] + 1u); }
+		// Counting sort into levels, keeping index order within each.
+		m_levelOffsets.assign(m_levelCount + 1, 0u);
+		m_levelEdgeCounts.assign(m_levelCount, 0u);
+		for (uint n = 0; n < m_neuronCount; n++) {
+			m_levelOffsets[levels[n] + 1]++;
+			m_levelEdgeCounts[levels[n]] += m_rowOffsets[n + 1] - m_rowOffsets[n];
+		}
+		for (uint l = 0; l < m_levelCount; l++) { m_levelOffsets[l + 1] += m_levelOffsets[l]; }
+
+		std::vector<uint> cursors(m_levelOffsets.begin(), m_levelOffsets.end() - 1);
+		m_levelNeurons.resize(m_neuronCount);
+		for (uint n = 0; n < m_neuronCount; n++) { m_levelNeurons[cursors[levels[n]]++] = n; }
+	}
+}
@@ -0,0 +1,26 @@
+#include "pch.h"
+#include "utils/allocationcounter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace Utils {
+	namespace {
+		// Only ever compared, never used to order anything else, so relaxed is enough.
+		std::atomic<size_t> s_allocations { 0 };
+	}
+
+	size_t AllocationCounter::getCount() { return s_allocations.load(std::memory_order_relaxed); }
+}
+
+#ifdef DEBUG
+// The array, nothrow and sized forms go through these two by default. Over-aligned allocations are not counted.
+void* operator new(std::size_t size)
+{
+	Utils::s_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc((size != 0) ? size : 1)) { return memory; }
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+#endif
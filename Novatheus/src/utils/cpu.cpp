@@ -0,0 +1,67 @@
+#include "pch.h"
+#include "utils/cpu.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace Utils {
+	namespace {
+		void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int (&registers)[4])
+		{
+#ifdef _MSC_VER
+			int r[4];
+			__cpuidex(r, (int)leaf, (int)subleaf);
+			for (int i = 0; i < 4; i++) { registers[i] = (unsigned int)r[i]; }
+#else
+			__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+		}
+
+		unsigned long long xgetbv()
+		{
+#ifdef _MSC_VER
+			return _xgetbv(0);
+#else
+			unsigned int eax, edx;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return ((unsigned long long)edx << 32) | eax;
+#endif
+		}
+	}
+
+	CpuFeatures::CpuFeatures()
+	{
+		unsigned int r[4]; // eax, ebx, ecx, edx
+		cpuid(0u, 0u, r);
+		const unsigned int maxLeaf = r[0];
+		if (maxLeaf < 1u) { return; }
+
+		cpuid(1u, 0u, r);
+		m_sse2 = (r[3] & (1u << 26)) != 0;
+		const bool fma = (r[2] & (1u << 12)) != 0;
+		const bool osxsave = (r[2] & (1u << 27)) != 0;
+		const bool avx = (r[2] & (1u << 28)) != 0;
+
+		// AVX state has to be enabled by the OS (XCR0 bits 1 and 2), and AVX-512 state on top of that (bits 5 to 7).
+		const unsigned long long xcr0 = osxsave ? xgetbv() : 0ull;
+		const bool ymmSaved = (xcr0 & 0x6ull) == 0x6ull;
+		const bool zmmSaved = (xcr0 & 0xE6ull) == 0xE6ull;
+
+		m_avx = avx && ymmSaved;
+		m_fma = fma && m_avx;
+
+		if (maxLeaf < 7u) { return; }
+		cpuid(7u, 0u, r);
+		m_avx2 = m_avx && (r[1] & (1u << 5)) != 0;
+		m_avx512f = zmmSaved && (r[1] & (1u << 16)) != 0;
+	}
+
+	const CpuFeatures& CpuFeatures::get()
+	{
+		static const CpuFeatures features;
+		return features;
+	}
+}
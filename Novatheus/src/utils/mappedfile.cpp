@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "utils/mappedfile.h"
+#include "utils/logger.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Utils {
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			WARN("Could not open '{0}' to map it.", path);
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			WARN("Could not map '{0}': it is empty, or its size could not be read.", path);
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view == nullptr) {
+			WARN("Could not map '{0}'.", path);
+			if (mapping != nullptr) { CloseHandle(mapping); }
+			CloseHandle(file);
+			return false;
+		}
+
+		mp_file = file;
+		mp_mapping = mapping;
+		m_size = (size_t)size.QuadPart;
+#else
+		int descriptor = ::open(path.c_str(), O_RDONLY);
+		if (descriptor == -1) {
+			WARN("Could not open '{0}' to map it.", path);
+			return false;
+		}
+
+		struct stat status;
+		if (fstat(descriptor, &status) == -1 || status.st_size == 0) {
+			WARN("Could not map '{0}': it is empty, or its size could not be read.", path);
+			::close(descriptor);
+			return false;
+		}
+
+		void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (view == MAP_FAILED) {
+			WARN("Could not map '{0}'.", path);
+			::close(descriptor);
+			return false;
+		}
+		madvise(view, (size_t)status.st_size, MADV_SEQUENTIAL); // Read ahead; every reader here goes front to back.
+
+		m_descriptor = descriptor;
+		m_size = (size_t)status.st_size;
+#endif
+
+		p_data = static_cast<const unsigned char*>(view);
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (p_data == nullptr) { return; }
+
+#if defined(_WIN32)
+		UnmapViewOfFile(p_data);
+		CloseHandle(mp_mapping);
+		CloseHandle(mp_file);
+		mp_mapping = nullptr;
+		mp_file = nullptr;
+#else
+		munmap(const_cast<unsigned char*>(p_data), m_size);
+		::close(m_descriptor);
+		m_descriptor = -1;
+#endif
+
+		p_data = nullptr;
+		m_size = 0;
+	}
+}
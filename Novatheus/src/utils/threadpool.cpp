@@ -0,0 +1,79 @@
+#include "pch.h"
+#include "utils/utils.h"
+#include "utils/threadpool.h"
+
+namespace Utils {
+	ThreadPool::ThreadPool(uint threadCount) :
+		m_threadCount(std::max(threadCount, 1u))
+	{
+		m_workers.reserve(m_threadCount - 1);
+		for (uint i = 1; i < m_threadCount; i++) {
+			m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+
+		for (auto& w : m_workers) { w.join(); }
+	}
+
+	void ThreadPool::workerLoop(uint workerIndex)
+	{
+		uint seenGeneration = 0u;
+		while (true) {
+			JobFunction job;
+			void* context;
+			uint count;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&]() { return m_stopping || m_jobGeneration != seenGeneration; });
+				if (m_stopping) { return; }
+
+				seenGeneration = m_jobGeneration;
+				job = mp_job;
+				context = mp_jobContext;
+				count = m_jobCount;
+			}
+
+			uint begin = getChunkBegin(count, m_threadCount, workerIndex);
+			uint end = getChunkBegin(count, m_threadCount, workerIndex + 1);
+			if (begin < end) { job(context, begin, end); }
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_jobsOutstanding == 0u) { m_done.notify_one(); }
+			}
+		}
+	}
+
+	void ThreadPool::runJob(uint count, JobFunction job, void* context)
+	{
+		if (m_workers.empty() || count < 2u) {
+			if (count > 0u) { job(context, 0u, count); }
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			mp_job = job;
+			mp_jobContext = context;
+			m_jobCount = count;
+			m_jobsOutstanding = (uint)m_workers.size();
+			++m_jobGeneration;
+		}
+		m_wake.notify_all();
+
+		// The calling thread takes the first chunk.
+		uint end = getChunkBegin(count, m_threadCount, 1u);
+		if (end > 0u) { job(context, 0u, end); }
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [&]() { return m_jobsOutstanding == 0u; });
+	}
+}